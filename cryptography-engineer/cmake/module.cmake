@@ -170,10 +170,27 @@ function(barretenberg_module MODULE_NAME)
             ${TBB_IMPORTED_TARGETS}
         )
 
-        add_custom_target(
-            run_${MODULE_NAME}_bench
-            COMMAND ${MODULE_NAME}_bench
-            WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
-        )
+        # results are also written as JSON, to be compared across builds
+        if(WASM)
+            target_link_options(
+                ${MODULE_NAME}_bench
+                PRIVATE
+                -Wl,-z,stack-size=8388608
+            )
+
+            # run in wasmtime, with the build directory mapped for the results
+            add_custom_target(
+                run_${MODULE_NAME}_bench
+                COMMAND wasmtime --dir=. $<TARGET_FILE:${MODULE_NAME}_bench>
+                        --benchmark_out=${MODULE_NAME}_bench.json --benchmark_out_format=json
+                WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+            )
+        else()
+            add_custom_target(
+                run_${MODULE_NAME}_bench
+                COMMAND ${MODULE_NAME}_bench --benchmark_out=${MODULE_NAME}_bench.json --benchmark_out_format=json
+                WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+            )
+        endif()
     endif()
 endfunction()
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace async {
+
+/**
+ * Shared by a long running task and its owner: the owner may cancel the task, which stops at its next checkpoint, and
+ * follows its progress meanwhile. The task sets the number of steps it will run, or adds to it as more work is queued,
+ * then counts them as they are done.
+ */
+class task_control {
+  public:
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+    void set_total(uint64_t total) { total_.store(total, std::memory_order_relaxed); }
+    void add_total(uint64_t steps) { total_.fetch_add(steps, std::memory_order_relaxed); }
+    void advance(uint64_t steps) { done_.fetch_add(steps, std::memory_order_relaxed); }
+
+    // fraction of the steps done, 0 until the task has started
+    double progress() const
+    {
+        const uint64_t total = total_.load(std::memory_order_relaxed);
+        return total == 0 ? 0 : static_cast<double>(done_.load(std::memory_order_relaxed)) / static_cast<double>(total);
+    }
+
+  private:
+    std::atomic<bool> cancelled_ = false;
+    std::atomic<uint64_t> done_ = 0;
+    std::atomic<uint64_t> total_ = 0;
+};
+
+} // namespace async
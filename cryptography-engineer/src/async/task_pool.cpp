@@ -0,0 +1,127 @@
+#include "task_pool.hpp"
+#ifndef NO_MULTITHREADING
+#include <algorithm>
+#include <omp.h>
+#endif
+
+namespace async {
+
+#ifndef NO_MULTITHREADING
+namespace {
+// the pool the current thread belongs to, if any, and the index of its queue
+thread_local task_pool const* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+} // namespace
+#endif
+
+task_pool::task_pool(size_t num_threads)
+    : num_threads_(num_threads)
+{
+#ifndef NO_MULTITHREADING
+    for (size_t i = 0; i < num_threads_; i++) {
+        queues_.push_back(std::make_unique<queue>());
+    }
+    for (size_t i = 0; i < num_threads_; i++) {
+        threads_.emplace_back([this, i]() { work(i); });
+    }
+#endif
+}
+
+/**
+ * The tasks already submitted, and those they submit, are all run before the threads are joined.
+ */
+task_pool::~task_pool()
+{
+#ifndef NO_MULTITHREADING
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+#endif
+}
+
+task_pool& task_pool::shared()
+{
+    static task_pool pool(DEFAULT_NUM_THREADS);
+    return pool;
+}
+
+void task_pool::push(std::function<void()> task)
+{
+#ifndef NO_MULTITHREADING
+    if (num_threads_ > 0) {
+        const size_t index = current_pool == this ? current_queue : next_queue_++ % num_threads_;
+        // counted before it is queued, so that it is never taken before it is counted
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+            queues_[index]->tasks.push_back(std::move(task));
+        }
+        ready_.notify_one();
+        return;
+    }
+#endif
+    task();
+}
+
+#ifndef NO_MULTITHREADING
+/**
+ * The oldest task of the queue at `index`, or else the most recent task of another queue.
+ */
+bool task_pool::take(size_t index, std::function<void()>& task)
+{
+    for (size_t i = 0; i < num_threads_; i++) {
+        auto& victim = *queues_[(index + i) % num_threads_];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        } else {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+void task_pool::work(size_t index)
+{
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        std::function<void()> task;
+        if (!take(index, task)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+            if (queued_ == 0) {
+                return;
+            }
+            // the task counted may be in the middle of being queued, or taken by another thread
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_--;
+        }
+
+        // the parallel regions of the task, run from this thread, get its share of the cores
+        const int running = ++running_;
+        omp_set_num_threads(std::max(1, omp_get_num_procs() / running));
+        task();
+        running_--;
+    }
+}
+#endif
+
+} // namespace async
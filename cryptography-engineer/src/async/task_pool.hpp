@@ -0,0 +1,80 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#ifndef NO_MULTITHREADING
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace async {
+
+/**
+ * Threads running tasks submitted from any thread, and handing back their results as futures.
+ *
+ * Every thread has a queue of its own. A task submitted by a task of the pool, such as the next update of a tree, goes
+ * to the queue of its thread, and is run there after the tasks queued before it; tasks submitted from elsewhere are
+ * dealt out to the queues in turn. A thread whose queue is empty steals the most recent task of another queue. Tasks
+ * are therefore not run in the order they were submitted, and must not block waiting for one another.
+ *
+ * Tasks are meant to be whole operations, such as a batch of tree updates or an SRS conversion, that already spread
+ * their own work across the cores with OpenMP. The pool only needs a thread per operation that should be in flight at
+ * once, not per core. The cores are shared between the tasks running at once: a task starting while k tasks run (its
+ * own included) gets OpenMP teams of 1/k of the cores, so the tasks do not oversubscribe them. Without multithreading,
+ * or with no threads, tasks run on the submitting thread and their futures are ready at once.
+ */
+class task_pool {
+  public:
+    explicit task_pool(size_t num_threads);
+    ~task_pool();
+
+    task_pool(task_pool const&) = delete;
+    task_pool& operator=(task_pool const&) = delete;
+
+    // The pool shared by the asynchronous operations of the modules, with `DEFAULT_NUM_THREADS` threads
+    static task_pool& shared();
+
+    static constexpr size_t DEFAULT_NUM_THREADS = 4;
+
+    template <typename F> std::future<std::invoke_result_t<F>> submit(F f)
+    {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(f));
+        auto result = task->get_future();
+        push([task]() { (*task)(); });
+        return result;
+    }
+
+    size_t num_threads() const { return num_threads_; }
+
+  private:
+    void push(std::function<void()> task);
+
+    size_t num_threads_;
+#ifndef NO_MULTITHREADING
+    void work(size_t index);
+    bool take(size_t index, std::function<void()>& task);
+
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::atomic<size_t> next_queue_ = 0;
+
+    // tasks queued and not taken yet, the threads sleep while there are none
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    size_t queued_ = 0;
+    bool stopping_ = false;
+
+    std::atomic<int> running_ = 0;
+    std::vector<std::thread> threads_;
+#endif
+};
+
+} // namespace async
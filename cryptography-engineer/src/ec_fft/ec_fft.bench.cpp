@@ -0,0 +1,97 @@
+#include "ec_fft.hpp"
+#include "srs_file.hpp"
+#include <benchmark/benchmark.h>
+
+using namespace benchmark;
+using namespace waffle::g1_fft;
+
+namespace {
+constexpr size_t MIN_LOG2_SIZE = 10;
+constexpr size_t MAX_LOG2_SIZE = 20;
+
+// The transforms do not depend on the points, which are just successive multiples of the generator
+const std::vector<g1::affine_element>& get_points()
+{
+    static const std::vector<g1::affine_element> points = [] {
+        constexpr size_t n = 1UL << MAX_LOG2_SIZE;
+        std::vector<g1::element> elements(n);
+        elements[0] = g1::one;
+        for (size_t i = 1; i < n; i++) {
+            elements[i] = elements[i - 1] + g1::one;
+        }
+        g1::element::batch_normalize(&elements[0], n);
+        std::vector<g1::affine_element> result(n);
+        for (size_t i = 0; i < n; i++) {
+            result[i] = g1::affine_element(elements[i].x, elements[i].y);
+        }
+        return result;
+    }();
+    return points;
+}
+
+evaluation_domain get_domain(const size_t n)
+{
+    evaluation_domain domain(n);
+    domain.compute_lookup_table();
+    return domain;
+}
+
+void fft_bench(State& state, void (*transform)(g1::element*, const evaluation_domain&)) noexcept
+{
+    const auto n = 1UL << static_cast<size_t>(state.range(0));
+    const auto& points = get_points();
+    const auto domain = get_domain(n);
+    std::vector<g1::element> elements(n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < n; i++) {
+            elements[i] = g1::element(points[i]);
+        }
+        state.ResumeTiming();
+        transform(&elements[0], domain);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(n));
+}
+
+void ec_fft_bench(State& state) noexcept
+{
+    fft_bench(state, ec_fft);
+}
+
+void ec_ifft_bench(State& state) noexcept
+{
+    fft_bench(state, ec_ifft);
+}
+
+void convert_srs_bench(State& state) noexcept
+{
+    const auto n = 1UL << static_cast<size_t>(state.range(0));
+    const auto domain = get_domain(n);
+    std::vector<g1::affine_element> monomial_srs(get_points().begin(), get_points().begin() + static_cast<long>(n));
+    std::vector<g1::affine_element> lagrange_srs(n);
+    for (auto _ : state) {
+        convert_srs(&monomial_srs[0], &lagrange_srs[0], domain);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(n));
+}
+// conversion with room for only 4 columns of the four-step schedule, about 4·√n points
+void convert_srs_chunked_bench(State& state) noexcept
+{
+    const auto log2_n = static_cast<size_t>(state.range(0));
+    const auto n = 1UL << log2_n;
+    const size_t max_points = std::min(n, 4UL << ((log2_n + 1) / 2));
+    std::vector<g1::affine_element> monomial_srs(get_points().begin(), get_points().begin() + static_cast<long>(n));
+    std::vector<g1::affine_element> lagrange_srs(n);
+    for (auto _ : state) {
+        convert_srs_chunked(&monomial_srs[0], &lagrange_srs[0], evaluation_domain(n), max_points);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(n));
+}
+} // namespace
+
+BENCHMARK(ec_fft_bench)->DenseRange(MIN_LOG2_SIZE, MAX_LOG2_SIZE, 2)->Unit(kMillisecond);
+BENCHMARK(ec_ifft_bench)->DenseRange(MIN_LOG2_SIZE, MAX_LOG2_SIZE, 2)->Unit(kMillisecond);
+BENCHMARK(convert_srs_bench)->DenseRange(MIN_LOG2_SIZE, MAX_LOG2_SIZE, 2)->Unit(kMillisecond);
+BENCHMARK(convert_srs_chunked_bench)->DenseRange(MIN_LOG2_SIZE, MAX_LOG2_SIZE, 2)->Unit(kMillisecond);
+
+BENCHMARK_MAIN();
@@ -1,7 +1,12 @@
 #include "ec_fft.hpp"
-
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "metrics.hpp"
+#include "srs_file.hpp"
+#include "twiddles.hpp"
+#include <algorithm>
+#include <chrono>
+#ifndef NO_MULTITHREADING
+#include <omp.h>
+#endif
 
 namespace waffle {
 namespace g1_fft {
@@ -22,12 +27,397 @@ inline uint32_t reverse_bits(uint32_t x, uint32_t bit_length)
     return (((x >> 16) | (x << 16))) >> (32 - bit_length);
 }
 
-inline void ec_fft_inner(g1::element* g1_elements, const size_t n, const std::vector<fr*>& root_table)
+/**
+ * Index of the round with butterflies of span 2m.
+ */
+inline size_t round_of(const size_t m)
+{
+    return numeric::get_msb(static_cast<uint64_t>(m));
+}
+
+/**
+ * Number of threads to split a transform of size `n` over: a power of two, with at least one butterfly per thread, and
+ * a single thread for a transform without any butterfly.
+ */
+inline size_t compute_num_threads(const size_t n)
+{
+#ifndef NO_MULTITHREADING
+    size_t num_threads = static_cast<size_t>(omp_get_max_threads());
+#else
+    size_t num_threads = 1;
+#endif
+    num_threads = 1UL << numeric::get_msb(static_cast<uint64_t>(num_threads));
+    while (num_threads > 1 && num_threads > n / 2) {
+        num_threads >>= 1;
+    }
+    return num_threads;
+}
+
+/**
+ * Twiddles of every round of a transform, `rounds[r]` being those of the round with butterflies of span 2m, m = 2^r
+ * (nullptr for the first round, whose only twiddle is 1).
+ *
+ * The transform can be scaled by a constant c for almost free: with the first element multiplied by c, and the
+ * twiddles of the first group of butterflies of every round (the ones computing elements 0 to 2m - 1) multiplied by c,
+ * the outputs of the first group of every round are the scaled outputs of the plain transform, while all the other
+ * groups are unchanged. Only the first group of the last round covers the whole output, so in the end all of it is
+ * scaled, for the cost of log2(n) + 1 extra multiplications. `first_group[r]` holds these scaled twiddles, which are
+ * recoded for this transform only: the shared tables of `get_round_twiddles` stay unscaled.
+ */
+struct fft_twiddles {
+    fft_twiddles(const size_t n, const std::vector<fr*>& root_table, const fr& scale)
+    {
+        const bool scaled = scale != fr::one();
+        rounds.push_back(nullptr);
+        first_group.push_back(scaled ? std::make_shared<const std::vector<twiddle>>(1, twiddle::recode(scale))
+                                     : nullptr);
+        for (size_t m = 2; m < n; m <<= 1) {
+            const fr* round_roots = root_table[rounds.size() - 1];
+            rounds.push_back(get_round_twiddles(round_roots, m));
+            first_group.push_back(scaled ? recode_round_twiddles(round_roots, m, scale) : rounds.back());
+        }
+    }
+
+    // twiddle of the butterfly of the round with span 2m whose first element is at `index`, nullptr if it is 1
+    const twiddle* get(const size_t m, const size_t index) const
+    {
+        size_t r = round_of(m);
+        const auto* round_twiddles = (index < m) ? first_group[r].get() : rounds[r].get();
+        return round_twiddles ? &(*round_twiddles)[index & (m - 1)] : nullptr;
+    }
+
+    std::vector<std::shared_ptr<const std::vector<twiddle>>> rounds;
+    std::vector<std::shared_ptr<const std::vector<twiddle>>> first_group;
+};
+
+/**
+ * Transforms from this size up are run on cache-sized blocks and tiles (see `fft_rounds`).
+ */
+constexpr size_t BLOCKED_FFT_THRESHOLD = 1UL << 16;
+
+/**
+ * Size of the blocks and tiles of a blocked transform, in points: 96kB of Jacobian points, which fits in L2.
+ */
+constexpr size_t CACHE_BLOCK_SIZE = 1UL << 10;
+
+/**
+ * Width of the tiles of a blocked transform, i.e. number of consecutive points read at once from each row. For
+ * Jacobian points, this is a multiple of the cache line size.
+ */
+constexpr size_t TILE_WIDTH = 8;
+
+/**
+ * Bit reversals are done on tiles of 2^BIT_REVERSAL_TILE_BITS x 2^BIT_REVERSAL_TILE_BITS points.
+ */
+constexpr uint32_t BIT_REVERSAL_TILE_BITS = 3;
+
+/**
+ * Calls f(i, reverse_bits(i)) for every index i < n.
+ *
+ * Writing i = (a, b, c) with a and c of BIT_REVERSAL_TILE_BITS bits, its bit reversal is (c', b', a'). Once the middle
+ * bits b are fixed, the indices (a, b, c) and their bit reversals span two tiles of rows of consecutive indices, which
+ * stay in cache as all their pairs are visited. The tiles are split across threads.
+ */
+template <typename F> inline void for_each_bit_reversal(const size_t n, F f)
 {
-    is_power_of_two(n);
-    ASSERT(!root_table.empty());
+    const auto log2_n = static_cast<uint32_t>(numeric::get_msb(static_cast<uint64_t>(n)));
 
-    // Exercise: implement the butterfly structure to perform ec-fft
+    if (log2_n < 2 * BIT_REVERSAL_TILE_BITS) {
+        for (size_t i = 0; i < n; i++) {
+            f(i, static_cast<size_t>(reverse_bits(static_cast<uint32_t>(i), log2_n)));
+        }
+        return;
+    }
+
+    const size_t tile_width = 1UL << BIT_REVERSAL_TILE_BITS;
+    const size_t num_tiles = n >> (2 * BIT_REVERSAL_TILE_BITS);
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+    for (size_t t = 0; t < num_tiles; t++) {
+        for (size_t a = 0; a < tile_width; a++) {
+            for (size_t c = 0; c < tile_width; c++) {
+                size_t i = (a << (log2_n - BIT_REVERSAL_TILE_BITS)) | (t << BIT_REVERSAL_TILE_BITS) | c;
+                f(i, static_cast<size_t>(reverse_bits(static_cast<uint32_t>(i), log2_n)));
+            }
+        }
+    }
+}
+
+template <typename T> inline void bit_reverse(T* elements, const size_t n)
+{
+    for_each_bit_reversal(n, [elements](const size_t i, const size_t swap_index) {
+        if (i < swap_index) {
+            std::swap(elements[i], elements[swap_index]);
+        }
+    });
+}
+
+/**
+ * Applies the butterflies `begin` to `end` of a round with butterflies of span 2m to `points`, i.e.
+ * (a, b) -> (a + ω·b, a - ω·b), where ω = `twiddle_of(k)` for the butterfly on points k and k + m (ω = 1 for nullptr).
+ * The work is counted towards `round` of the transform.
+ */
+template <typename TwiddleOf>
+inline void butterflies(g1::element* points,
+                        const size_t round,
+                        const size_t m,
+                        TwiddleOf twiddle_of,
+                        const size_t begin,
+                        const size_t end)
+{
+    const uint64_t start = metrics::now();
+    uint64_t num_multiplications = 0;
+    for (size_t b = begin; b < end; b++) {
+        size_t i = b & (m - 1);
+        size_t k = 2 * (b - i) + i;
+        const twiddle* root = twiddle_of(k);
+        g1::element t = points[k + m];
+        if (root) {
+            t = *root * t;
+            num_multiplications++;
+        }
+        points[k + m] = points[k] - t;
+        points[k] += t;
+    }
+    metrics::add_round(round, num_multiplications, 2 * (end - begin), start);
+}
+
+/**
+ * Number of affine butterflies sharing a batch inversion.
+ */
+constexpr size_t AFFINE_BATCH_SIZE = 1024;
+
+/**
+ * Same as `butterflies`, on affine points.
+ *
+ * With t = ω·b = (X, Y, Z) in Jacobian coordinates and H = X - x_a·Z², the slopes of a + t and a - t are
+ * (±Y - y_a·Z³) / (Z·H), and t is at x = X / Z². All these divisions follow from the single inverse of D = Z³·H, and
+ * the inverses of a whole batch of butterflies are computed at once. A butterfly with D = 0, i.e. with a point at
+ * infinity or a = ±t, is done in Jacobian coordinates instead.
+ */
+template <typename TwiddleOf>
+inline void butterflies(g1::affine_element* points,
+                        const size_t round,
+                        const size_t m,
+                        TwiddleOf twiddle_of,
+                        const size_t begin,
+                        const size_t end)
+{
+    const uint64_t start = metrics::now();
+    uint64_t num_multiplications = 0;
+    const size_t max_batch_size = std::min(AFFINE_BATCH_SIZE, end - begin);
+    std::vector<g1::element> t(max_batch_size);
+    std::vector<fq> denominators(max_batch_size);
+    std::vector<fq> products(max_batch_size);
+
+    for (size_t batch = begin; batch < end; batch += AFFINE_BATCH_SIZE) {
+        const size_t batch_size = std::min(AFFINE_BATCH_SIZE, end - batch);
+
+        fq accumulator = fq::one();
+        for (size_t c = 0; c < batch_size; c++) {
+            size_t i = (batch + c) & (m - 1);
+            size_t k = 2 * (batch + c - i) + i;
+            const twiddle* root = twiddle_of(k);
+            t[c] = g1::element(points[k + m]);
+            if (root) {
+                t[c] = *root * t[c];
+                num_multiplications++;
+            }
+
+            const auto& a = points[k];
+            if (a.is_point_at_infinity() || t[c].is_point_at_infinity()) {
+                denominators[c] = fq::zero();
+            } else {
+                fq zz = t[c].z.sqr();
+                denominators[c] = zz * t[c].z * (t[c].x - a.x * zz);
+            }
+
+            // Montgomery batch inversion: products[c] is the product of the non-zero denominators before c
+            products[c] = accumulator;
+            if (!denominators[c].is_zero()) {
+                accumulator *= denominators[c];
+            }
+        }
+
+        fq inverse = accumulator.invert();
+        for (size_t c = batch_size; c > 0; c--) {
+            size_t i = (batch + c - 1) & (m - 1);
+            size_t k = 2 * (batch + c - 1 - i) + i;
+            const g1::element& tc = t[c - 1];
+            const g1::affine_element a = points[k];
+
+            if (denominators[c - 1].is_zero()) {
+                points[k] = g1::affine_element(g1::element(a) + tc);
+                points[k + m] = g1::affine_element(g1::element(a) - tc);
+                continue;
+            }
+
+            fq d_inv = inverse * products[c - 1];
+            inverse *= denominators[c - 1];
+
+            fq zz = tc.z.sqr();
+            fq zh_inv = zz * d_inv;
+            fq x_t = tc.x * (tc.z * (tc.x - a.x * zz)) * d_inv;
+            fq y_a_zzz = a.y * zz * tc.z;
+
+            fq lambda = (tc.y - y_a_zzz) * zh_inv;
+            fq x_sum = lambda.sqr() - a.x - x_t;
+            points[k] = g1::affine_element(x_sum, lambda * (a.x - x_sum) - a.y);
+
+            lambda = (-tc.y - y_a_zzz) * zh_inv;
+            fq x_diff = lambda.sqr() - a.x - x_t;
+            points[k + m] = g1::affine_element(x_diff, lambda * (a.x - x_diff) - a.y);
+        }
+    }
+    metrics::add_round(round, num_multiplications, 2 * (end - begin), start);
+}
+
+/**
+ * A radix-2 decimation-in-time FFT of points already in bit-reversed order, scaled by `scale`: the rounds with
+ * butterflies of span 2, 4, ..., n are applied in place. The twiddles of every round are recoded for fast
+ * multiplication once, and reused by all later transforms.
+ *
+ * Each butterfly costs a scalar multiplication, so the work is split across threads in two phases. The first rounds
+ * only combine points within blocks of size n / num_threads: every thread runs them all on its own block. In each of
+ * the remaining rounds, the n / 2 butterflies are split evenly across the threads.
+ *
+ * From BLOCKED_FFT_THRESHOLD up, the points no longer fit in cache and a round sweeping through all of them would be
+ * bound by memory bandwidth, so they are instead processed in cache-sized pieces, in the manner of a four-step FFT:
+ * 1. the rounds with spans up to CACHE_BLOCK_SIZE combine points within contiguous blocks of that size, and all run on
+ *    one block after another;
+ * 2. the remaining rounds are grouped in passes of log2(CACHE_BLOCK_SIZE / TILE_WIDTH). The rounds of a pass, with
+ *    spans 2m to 2^r·m, combine the points at stride m within groups of 2^r·m points. These are gathered in tiles of
+ *    2^r rows of TILE_WIDTH consecutive points, on which all the rounds of the pass run before they are written back.
+ */
+template <typename Element>
+void fft_rounds(Element* points, const size_t n, const std::vector<fr*>& root_table, const fr& scale)
+{
+    const fft_twiddles twiddles(n, root_table, scale);
+
+    if (scale != fr::one()) {
+        const uint64_t start = metrics::now();
+        points[0] = Element(*twiddles.get(1, 0) * g1::element(points[0]));
+        metrics::add_round(0, 1, 0, start);
+    }
+
+    if (n < BLOCKED_FFT_THRESHOLD) {
+        const size_t num_threads = compute_num_threads(n);
+        const size_t block_size = n / num_threads;
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+        for (size_t j = 0; j < num_threads; j++) {
+            const size_t offset = j * block_size;
+            for (size_t m = 1; m < block_size; m <<= 1) {
+                butterflies(
+                    &points[offset],
+                    round_of(m),
+                    m,
+                    [&](const size_t k) { return twiddles.get(m, offset + k); },
+                    0,
+                    block_size / 2);
+            }
+        }
+
+        const size_t butterflies_per_thread = n / 2 / num_threads;
+        for (size_t m = block_size; m < n; m <<= 1) {
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+            for (size_t j = 0; j < num_threads; j++) {
+                butterflies(
+                    points,
+                    round_of(m),
+                    m,
+                    [&](const size_t k) { return twiddles.get(m, k); },
+                    j * butterflies_per_thread,
+                    (j + 1) * butterflies_per_thread);
+            }
+        }
+        return;
+    }
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+    for (size_t j = 0; j < n / CACHE_BLOCK_SIZE; j++) {
+        const size_t offset = j * CACHE_BLOCK_SIZE;
+        for (size_t m = 1; m < CACHE_BLOCK_SIZE; m <<= 1) {
+            butterflies(
+                &points[offset],
+                round_of(m),
+                m,
+                [&](const size_t k) { return twiddles.get(m, offset + k); },
+                0,
+                CACHE_BLOCK_SIZE / 2);
+        }
+    }
+
+    const size_t max_rounds_per_pass = numeric::get_msb(static_cast<uint64_t>(CACHE_BLOCK_SIZE / TILE_WIDTH));
+    const size_t log2_tile_width = numeric::get_msb(static_cast<uint64_t>(TILE_WIDTH));
+    size_t num_rounds = 0;
+    for (size_t m = CACHE_BLOCK_SIZE; m < n; m <<= num_rounds) {
+        num_rounds = std::min(max_rounds_per_pass, static_cast<size_t>(numeric::get_msb(static_cast<uint64_t>(n / m))));
+        const size_t num_rows = 1UL << num_rounds;
+        const size_t tile_size = num_rows * TILE_WIDTH;
+        const size_t tiles_per_group = m / TILE_WIDTH;
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+        for (size_t t = 0; t < n / tile_size; t++) {
+            // the tile holds the points group_offset + column_offset + row·m + column
+            const size_t group_offset = (t / tiles_per_group) * num_rows * m;
+            const size_t column_offset = (t % tiles_per_group) * TILE_WIDTH;
+            Element* const first = &points[group_offset + column_offset];
+            std::vector<Element> tile(tile_size);
+            for (size_t row = 0; row < num_rows; row++) {
+                std::copy_n(first + row * m, TILE_WIDTH, &tile[row * TILE_WIDTH]);
+            }
+
+            // on the tile, the round with span 2^(r+1)·m is a round with span 2^(r+1)·TILE_WIDTH
+            for (size_t r = 0; r < num_rounds; r++) {
+                butterflies(
+                    &tile[0],
+                    round_of(m) + r,
+                    TILE_WIDTH << r,
+                    [&](const size_t k) {
+                        const size_t index = (k >> log2_tile_width) * m + (k & (TILE_WIDTH - 1));
+                        return twiddles.get(m << r, group_offset + column_offset + index);
+                    },
+                    0,
+                    tile_size / 2);
+            }
+
+            for (size_t row = 0; row < num_rows; row++) {
+                std::copy_n(&tile[row * TILE_WIDTH], TILE_WIDTH, first + row * m);
+            }
+        }
+    }
+}
+
+void ec_fft_inner(g1::element* g1_elements, const size_t n, const std::vector<fr*>& root_table)
+{
+    ASSERT(is_power_of_two(n));
+    ASSERT(n == 1 || !root_table.empty());
+
+    bit_reverse(g1_elements, n);
+    fft_rounds(g1_elements, n, root_table, fr::one());
+}
+
+/**
+ * Same as `ec_fft_inner`, on affine points: every round is done with affine additions sharing batch inversions, which
+ * are cheaper than Jacobian additions and halve the size of the points in memory.
+ */
+void ec_fft_inner_affine(g1::affine_element* g1_elements, const size_t n, const std::vector<fr*>& root_table)
+{
+    ASSERT(is_power_of_two(n));
+    ASSERT(n == 1 || !root_table.empty());
+
+    bit_reverse(g1_elements, n);
+    fft_rounds(g1_elements, n, root_table, fr::one());
 }
 
 void ec_fft(g1::element* g1_elements, const evaluation_domain& domain)
@@ -35,25 +425,102 @@ void ec_fft(g1::element* g1_elements, const evaluation_domain& domain)
     ec_fft_inner(g1_elements, domain.size, domain.get_round_roots());
 }
 
+/**
+ * The 1/n scaling is folded into the transform.
+ */
 void ec_ifft(g1::element* g1_elements, const evaluation_domain& domain)
 {
-    ec_fft_inner(g1_elements, domain.size, domain.get_inverse_round_roots());
-    for (size_t i = 0; i < domain.size; i++) {
-        g1_elements[i] *= domain.domain_inverse;
-    }
+    ASSERT(is_power_of_two(domain.size));
+
+    bit_reverse(g1_elements, domain.size);
+    fft_rounds(g1_elements, domain.size, domain.get_inverse_round_roots(), domain.domain_inverse);
 }
 
+/**
+ * The Lagrange SRS is read off the EC-FFT of the monomial SRS: [L_i(x)]₁ = 1/n · [P(ω⁻ⁱ)]₁.
+ * This is the iFFT of the monomial SRS, in the natural order and with the 1/n scaling folded in. It runs on affine
+ * points, in place in `lagrange_srs`.
+ */
 void convert_srs(g1::affine_element* monomial_srs, g1::affine_element* lagrange_srs, const evaluation_domain& domain)
 {
     const size_t n = domain.size;
-    is_power_of_two(n);
+    ASSERT(is_power_of_two(n));
+
+    // the transform holds about n unscaled twiddles, shared with the tables already kept, and n scaled ones of its own
+    constexpr size_t budget = MEMORY_BUDGET / sizeof(twiddle);
+    if (n > budget / 2) {
+        convert_srs_chunked(monomial_srs, lagrange_srs, domain, MEMORY_BUDGET / sizeof(g1::affine_element));
+        return;
+    }
+    if (cached_round_twiddles() > budget - 2 * n) {
+        clear_round_twiddles();
+    }
+
+    // the monomial SRS is copied in bit-reversed order, ready for the butterflies
+    for_each_bit_reversal(n, [&](const size_t i, const size_t j) { lagrange_srs[j] = monomial_srs[i]; });
+
+    fft_rounds(lagrange_srs, n, domain.get_inverse_round_roots(), domain.domain_inverse);
+}
+
+/**
+ * All the domains share the recoded twiddles of their common rounds, which are first recoded once for the largest
+ * domain, before the concurrent conversions would all miss them at once.
+ */
+batch_conversion_report convert_srs_batch(g1::affine_element* monomial_srs,
+                                          const std::vector<evaluation_domain>& domains,
+                                          const std::vector<g1::affine_element*>& lagrange_srs)
+{
+    ASSERT(domains.size() == lagrange_srs.size());
+    const auto start = std::chrono::steady_clock::now();
+    batch_conversion_report report = { 0, std::vector<double>(domains.size()) };
+    if (domains.empty()) {
+        return report;
+    }
+
+    const auto largest = std::max_element(domains.begin(), domains.end(), [](const auto& a, const auto& b) {
+        return a.size < b.size;
+    });
+    for (size_t m = 2; m < largest->size; m <<= 1) {
+        get_round_twiddles(largest->get_inverse_round_roots()[round_of(m) - 1], m);
+    }
+
+#ifndef NO_MULTITHREADING
+    // a domain of size n takes about n·log2(n) multiplications
+    std::vector<double> work(domains.size());
+    for (size_t i = 0; i < domains.size(); i++) {
+        work[i] = static_cast<double>(domains[i].size) * static_cast<double>(numeric::get_msb(domains[i].size));
+    }
+    double total_work = 0;
+    for (double w : work) {
+        total_work += w;
+    }
+    const auto num_threads = static_cast<double>(omp_get_max_threads());
+    std::vector<int> domain_threads(domains.size());
+    for (size_t i = 0; i < domains.size(); i++) {
+        domain_threads[i] = std::max(1, static_cast<int>(num_threads * work[i] / total_work));
+    }
+
+    // each conversion runs its own parallel regions, nested in the one running the conversions
+    const int max_active_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(std::max(max_active_levels, 2));
+#pragma omp parallel for num_threads(static_cast<int>(domains.size())) schedule(dynamic)
+#endif
+    for (size_t i = 0; i < domains.size(); i++) {
+#ifndef NO_MULTITHREADING
+        omp_set_num_threads(domain_threads[i]);
+#endif
+        const auto domain_start = std::chrono::steady_clock::now();
+        convert_srs(monomial_srs, lagrange_srs[i], domains[i]);
+        report.domain_seconds[i] =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - domain_start).count();
+    }
+#ifndef NO_MULTITHREADING
+    omp_set_max_active_levels(max_active_levels);
+#endif
 
-    // Exercise: implement the conversion of monomial to Lagrange SRS
-    // Note that you can convert from g1::affine_element form to g1::element by just doing:
-    // g1::affine_element x_affine = g1::affine_one;
-    // auto x_elem = g1::element(x_affine);
-    // Conversion from g1::element to g1::affine_element can be done similarly.
+    report.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
 }
 
 } // namespace g1_fft
-} // namespace waffle
\ No newline at end of file
+} // namespace waffle
@@ -2,6 +2,7 @@
 #include <polynomials/evaluation_domain.hpp>
 #include <ecc/curves/bn254/g1.hpp>
 #include <numeric/bitop/get_msb.hpp>
+#include <vector>
 
 namespace waffle {
 namespace g1_fft {
@@ -26,6 +27,12 @@ using namespace barretenberg;
  */
 void ec_fft_inner(g1::element* g1_elements, const size_t n, const std::vector<fr*>& root_table);
 
+/**
+ * Computes the same FFT as `ec_fft_inner` on affine curve points `g1_elements`, in place.
+ * Each butterfly round is done with affine additions that share batched field inversions.
+ */
+void ec_fft_inner_affine(g1::affine_element* g1_elements, const size_t n, const std::vector<fr*>& root_table);
+
 /**
  * Computes EC-FFT of `g1_elements` given the evaluation domain `domain`.
  *
@@ -42,14 +49,44 @@ void ec_fft(g1::element* g1_elements, const evaluation_domain& domain);
  */
 void ec_ifft(g1::element* g1_elements, const evaluation_domain& domain);
 
+/**
+ * Bytes the SRS conversion may allocate on top of the two SRS buffers, set in MB by the MEMORY_BUDGET_MB build option
+ * (which defaults to 1024 on WASM), unbounded otherwise.
+ */
+#ifdef MEMORY_BUDGET_MB
+constexpr size_t MEMORY_BUDGET = static_cast<size_t>(MEMORY_BUDGET_MB) << 20;
+#else
+constexpr size_t MEMORY_BUDGET = SIZE_MAX;
+#endif
+
 /**
  * Using `ec_fft`, computes the Lagrange form of the SRS given the monomial form SRS `monomial_srs`.
  *
+ * A transform of n points recodes about n twiddles once, which are then kept for later transforms (see
+ * `get_round_twiddles`), and about n more scaled by 1/n for itself. When they would not fit in `MEMORY_BUDGET`, the
+ * conversion is run by `convert_srs_chunked` instead; when they only would not fit next to the twiddles already kept,
+ * those are dropped first.
+ *
  * @param monomial_srs: Monomial SRS of the form: ([1]₁, [x]₁, [x²]₁, [x³]₁, ..., [xⁿ⁻¹]₁)
  * @param lagrange_srs: Result must be stored in this, it should be of the form: ([L₀(x)]₁, [L₁(x)]₁, ..., [Lⁿ⁻¹(x)]₁)
  * @param domain: contains the information about n-th roots of unity
  */
 void convert_srs(g1::affine_element* monomial_srs, g1::affine_element* lagrange_srs, const evaluation_domain& domain);
 
+struct batch_conversion_report {
+    double total_seconds;
+    std::vector<double> domain_seconds;
+};
+
+/**
+ * Runs `convert_srs` for each of `domains`, from the same monomial SRS, storing the Lagrange SRS of `domains[i]` in
+ * `lagrange_srs[i]`. The conversions run concurrently, each on its own share of the threads, proportional to the work.
+ *
+ * @return the wall time of the whole batch and of each conversion, in seconds
+ */
+batch_conversion_report convert_srs_batch(g1::affine_element* monomial_srs,
+                                          const std::vector<evaluation_domain>& domains,
+                                          const std::vector<g1::affine_element*>& lagrange_srs);
+
 } // namespace g1_fft
 } // namespace waffle
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include "ec_fft.hpp"
+#include "metrics.hpp"
+#include "srs_cache.hpp"
+#include "srs_file.hpp"
+#include "twiddles.hpp"
 #include <gtest/gtest.h>
 
 #include <ecc/curves/bn254/g1.hpp>
@@ -11,6 +15,41 @@
 
 using namespace barretenberg;
 
+TEST(ec_fft, test_twiddle_multiplication)
+{
+    auto domain = evaluation_domain(1024);
+    std::vector<fr> scalars = { fr::one(), -fr::one(), fr::zero(), domain.root, domain.root_inverse };
+    for (size_t i = 0; i < 20; i++) {
+        scalars.push_back(fr::random_element());
+    }
+
+    g1::element point = g1::one * fr::random_element();
+    for (auto const& scalar : scalars) {
+        auto twiddle = waffle::g1_fft::twiddle::recode(scalar);
+        EXPECT_EQ((twiddle * point).normalize(), (point * scalar).normalize());
+    }
+}
+
+TEST(ec_fft, test_round_twiddles_cache)
+{
+    constexpr size_t n = 16;
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+    std::vector<g1::element> points(n, g1::one);
+
+    // The rounds of a transform are kept unscaled: the inverse transform only adds its own rounds, not the scaled ones
+    waffle::g1_fft::clear_round_twiddles();
+    waffle::g1_fft::ec_fft(&points[0], domain);
+    EXPECT_EQ(waffle::g1_fft::cached_round_twiddles(), 2 + 4 + 8);
+    waffle::g1_fft::ec_ifft(&points[0], domain);
+    EXPECT_EQ(waffle::g1_fft::cached_round_twiddles(), 2 * (2 + 4 + 8));
+    waffle::g1_fft::ec_ifft(&points[0], domain);
+    EXPECT_EQ(waffle::g1_fft::cached_round_twiddles(), 2 * (2 + 4 + 8));
+
+    waffle::g1_fft::clear_round_twiddles();
+    EXPECT_EQ(waffle::g1_fft::cached_round_twiddles(), 0);
+}
+
 TEST(ec_fft, test_fft_ifft)
 {
     constexpr size_t n = 256;
@@ -37,6 +76,18 @@ TEST(ec_fft, test_fft_ifft)
     }
 }
 
+TEST(ec_fft, test_fft_single_point)
+{
+    // a transform without butterflies needs no lookup table
+    auto domain = evaluation_domain(1);
+    g1::element point = g1::one * fr::random_element();
+    std::vector<g1::element> points = { point };
+    waffle::g1_fft::ec_fft(&points[0], domain);
+    EXPECT_EQ(points[0].normalize(), point.normalize());
+    waffle::g1_fft::ec_ifft(&points[0], domain);
+    EXPECT_EQ(points[0].normalize(), point.normalize());
+}
+
 TEST(ec_fft, test_compare_ffts)
 {
     constexpr size_t n = 256;
@@ -72,6 +123,55 @@ TEST(ec_fft, test_compare_ffts)
     }
 }
 
+TEST(ec_fft, test_compare_ffts_sizes)
+{
+    // From the smallest domain up to sizes split into several blocks per thread, and transformed in cache blocks
+    for (size_t n : { 4UL, 8UL, 32UL, 1024UL, 1UL << 16 }) {
+        std::vector<g1::element> points;
+        std::vector<fr> poly;
+        for (size_t i = 0; i < n; i++) {
+            fr multiplicand = fr::random_element();
+            poly.push_back(multiplicand);
+            points.push_back(g1::one * multiplicand);
+        }
+
+        auto domain = evaluation_domain(n);
+        domain.compute_lookup_table();
+
+        waffle::g1_fft::ec_fft(&points[0], domain);
+        polynomial_arithmetic::fft(&poly[0], domain);
+
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_EQ((g1::one * poly[i]).normalize(), points[i].normalize());
+        }
+    }
+}
+
+TEST(ec_fft, test_affine_fft)
+{
+    constexpr size_t n = 256;
+    std::vector<g1::element> points;
+    std::vector<g1::affine_element> affine_points;
+
+    for (size_t i = 0; i < n; i++) {
+        // include points at infinity and repeated points, which the affine additions cannot handle
+        fr multiplicand = (i % 64 == 0) ? fr::zero() : (i % 64 == 1) ? fr::one() : fr::random_element();
+        g1::element point = g1::one * multiplicand;
+        points.push_back(point);
+        affine_points.push_back(g1::affine_element(point));
+    }
+
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+
+    waffle::g1_fft::ec_fft(&points[0], domain);
+    waffle::g1_fft::ec_fft_inner_affine(&affine_points[0], n, domain.get_round_roots());
+
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(g1::affine_element(points[i]), affine_points[i]);
+    }
+}
+
 TEST(ec_fft, test_compare_iffts)
 {
     constexpr size_t n = 256;
@@ -158,4 +258,265 @@ TEST(ec_fft, test_convert_srs)
     result = result.normalize();
 
     EXPECT_EQ(result, expected);
-}
\ No newline at end of file
+}
+
+#ifdef MEMORY_BUDGET_MB
+TEST(ec_fft, test_convert_srs_twiddle_budget)
+{
+    // The largest conversion run in one piece, after a transform twice its size that fills the cache with its twiddles
+    constexpr size_t budget = waffle::g1_fft::MEMORY_BUDGET / sizeof(waffle::g1_fft::twiddle);
+    size_t n = 1;
+    while (4 * n <= budget) {
+        n *= 2;
+    }
+    auto large_domain = evaluation_domain(2 * n);
+    large_domain.compute_lookup_table();
+    std::vector<g1::element> points(2 * n, g1::one);
+    waffle::g1_fft::clear_round_twiddles();
+    waffle::g1_fft::ec_fft(&points[0], large_domain);
+
+    // The twiddles kept afterwards and the scaled ones of the conversion fit in the budget together
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+    std::vector<g1::affine_element> monomial_srs(n, g1::affine_element(g1::one));
+    std::vector<g1::affine_element> lagrange_srs(n);
+    waffle::g1_fft::convert_srs(&monomial_srs[0], &lagrange_srs[0], domain);
+    EXPECT_LE(waffle::g1_fft::cached_round_twiddles() + n, budget);
+    waffle::g1_fft::clear_round_twiddles();
+}
+#endif
+
+TEST(ec_fft, test_convert_srs_batch)
+{
+    constexpr size_t n = 256;
+    std::vector<g1::affine_element> monomial_srs;
+    const fr x = fr::random_element();
+    fr power = 1;
+    for (size_t i = 0; i < n; i++) {
+        monomial_srs.push_back(g1::affine_element(g1::one * power));
+        power *= x;
+    }
+
+    std::vector<evaluation_domain> domains;
+    for (size_t size : { n / 4, n, n / 2 }) {
+        domains.push_back(evaluation_domain(size));
+        domains.back().compute_lookup_table();
+    }
+    std::vector<std::vector<g1::affine_element>> lagrange_srs;
+    std::vector<g1::affine_element*> outputs;
+    for (const auto& domain : domains) {
+        lagrange_srs.push_back(std::vector<g1::affine_element>(domain.size));
+        outputs.push_back(&lagrange_srs.back()[0]);
+    }
+
+    auto report = waffle::g1_fft::convert_srs_batch(&monomial_srs[0], domains, outputs);
+    EXPECT_EQ(report.domain_seconds.size(), domains.size());
+
+    for (size_t i = 0; i < domains.size(); i++) {
+        std::vector<g1::affine_element> expected(domains[i].size);
+        waffle::g1_fft::convert_srs(&monomial_srs[0], &expected[0], domains[i]);
+        EXPECT_EQ(lagrange_srs[i], expected);
+        EXPECT_LE(report.domain_seconds[i], report.total_seconds);
+    }
+}
+
+TEST(ec_fft, test_metrics)
+{
+    using namespace waffle::g1_fft;
+    constexpr size_t n = 16;
+    std::vector<g1::element> points(n, g1::one);
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+
+    metrics::reset();
+    ec_fft(&points[0], domain);
+    auto rounds = metrics::snapshot();
+
+    if constexpr (!metrics::enabled) {
+        EXPECT_TRUE(rounds.empty());
+        return;
+    }
+    ASSERT_EQ(rounds.size(), 4UL);
+    for (size_t r = 0; r < rounds.size(); r++) {
+        // every butterfly takes two additions, and a multiplication unless its twiddle is 1 as in the first round
+        EXPECT_EQ(rounds[r].point_additions, n);
+        EXPECT_EQ(rounds[r].scalar_multiplications, r == 0 ? 0 : n / 2);
+    }
+
+    // the scaling of the inverse transform adds two multiplications to the first round
+    metrics::reset();
+    ec_ifft(&points[0], domain);
+    EXPECT_EQ(metrics::snapshot()[0].scalar_multiplications, 2UL);
+}
+
+TEST(ec_fft, test_convert_srs_chunked)
+{
+    // n₁ = n₂ = 16, then n₁ = 16 and n₂ = 32
+    for (size_t n : { 256UL, 512UL }) {
+        std::vector<g1::affine_element> monomial_srs;
+        const fr x = fr::random_element();
+        fr power = 1;
+        for (size_t i = 0; i < n; i++) {
+            monomial_srs.push_back(g1::affine_element(g1::one * power));
+            power *= x;
+        }
+
+        auto domain = evaluation_domain(n);
+        domain.compute_lookup_table();
+        std::vector<g1::affine_element> expected(n);
+        waffle::g1_fft::convert_srs(&monomial_srs[0], &expected[0], domain);
+
+        // room for a single column, for a few columns, and for the whole SRS
+        for (size_t max_points : { n == 256 ? 16UL : 32UL, 96UL, n }) {
+            std::vector<g1::affine_element> lagrange_srs(n);
+            waffle::g1_fft::convert_srs_chunked(&monomial_srs[0], &lagrange_srs[0], evaluation_domain(n), max_points);
+            EXPECT_EQ(lagrange_srs, expected);
+        }
+    }
+}
+
+TEST(ec_fft, test_convert_srs_async)
+{
+    constexpr size_t n = 512;
+    std::vector<g1::affine_element> monomial_srs;
+    const fr x = fr::random_element();
+    fr power = 1;
+    for (size_t i = 0; i < n; i++) {
+        monomial_srs.push_back(g1::affine_element(g1::one * power));
+        power *= x;
+    }
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+    std::vector<g1::affine_element> expected(n);
+    waffle::g1_fft::convert_srs(&monomial_srs[0], &expected[0], domain);
+
+    // two conversions in flight at once, the second one cancelled before it starts
+    async::task_pool pool(2);
+    std::vector<g1::affine_element> lagrange_srs(n);
+    std::vector<g1::affine_element> cancelled_srs(n);
+    auto control = std::make_shared<async::task_control>();
+    auto cancelled = std::make_shared<async::task_control>();
+    cancelled->cancel();
+    auto conversion = waffle::g1_fft::convert_srs_async(pool, &monomial_srs[0], &lagrange_srs[0], domain, control);
+    auto cancelled_conversion =
+        waffle::g1_fft::convert_srs_async(pool, &monomial_srs[0], &cancelled_srs[0], domain, cancelled);
+
+    EXPECT_TRUE(conversion.get());
+    EXPECT_EQ(lagrange_srs, expected);
+    EXPECT_EQ(control->progress(), 1.0);
+    EXPECT_FALSE(cancelled_conversion.get());
+    EXPECT_EQ(cancelled->progress(), 0.0);
+}
+
+#ifndef __wasm__
+TEST(ec_fft, test_convert_srs_file)
+{
+    constexpr size_t n = 512;
+    std::string monomial_path = "ec_fft_test_monomial.srs";
+    std::string lagrange_path = "ec_fft_test_lagrange.srs";
+    std::remove((lagrange_path + ".progress").c_str());
+
+    // a larger file left over from a bigger conversion is cut to the size of this one
+    FILE* file = std::fopen(lagrange_path.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    std::vector<uint8_t> stale(4 * n * sizeof(g1::affine_element), 0xff);
+    std::fwrite(&stale[0], 1, stale.size(), file);
+    std::fclose(file);
+
+    std::vector<g1::affine_element> monomial_srs;
+    const fr x = fr::random_element();
+    fr power = 1;
+    for (size_t i = 0; i < n; i++) {
+        monomial_srs.push_back(g1::affine_element(g1::one * power));
+        power *= x;
+    }
+    file = std::fopen(monomial_path.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    std::fwrite(&monomial_srs[0], sizeof(g1::affine_element), n, file);
+    std::fclose(file);
+
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+    std::vector<g1::affine_element> expected(n);
+    waffle::g1_fft::convert_srs(&monomial_srs[0], &expected[0], domain);
+
+    // With room for 2 columns of 32 points, each pass runs in 8 batches: stop and resume every 3 of them
+    using waffle::g1_fft::conversion_status;
+    auto status = conversion_status::INCOMPLETE;
+    size_t num_calls = 0;
+    while (status == conversion_status::INCOMPLETE) {
+        status = waffle::g1_fft::convert_srs_file(monomial_path, lagrange_path, evaluation_domain(n), 64, 3);
+        num_calls++;
+    }
+    EXPECT_EQ(status, conversion_status::COMPLETE);
+    EXPECT_EQ(num_calls, 6UL);
+
+    std::vector<g1::affine_element> lagrange_srs(n);
+    file = std::fopen(lagrange_path.c_str(), "rb");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(std::fread(&lagrange_srs[0], sizeof(g1::affine_element), n, file), n);
+    EXPECT_EQ(std::fgetc(file), EOF);
+    std::fclose(file);
+    EXPECT_EQ(lagrange_srs, expected);
+
+    // A missing monomial file is reported
+    std::remove(monomial_path.c_str());
+    EXPECT_EQ(waffle::g1_fft::convert_srs_file(monomial_path, lagrange_path, evaluation_domain(n), 64),
+              conversion_status::FAILED);
+    std::remove(lagrange_path.c_str());
+}
+#endif
+
+#ifndef __wasm__
+TEST(ec_fft, test_lagrange_srs_cache)
+{
+    constexpr size_t n = 128;
+    waffle::g1_fft::lagrange_srs_cache cache(".");
+    std::remove(cache.path(n).c_str());
+    std::remove(cache.path(n / 2).c_str());
+
+    std::vector<g1::affine_element> monomial_srs;
+    const fr x = fr::random_element();
+    fr power = 1;
+    for (size_t i = 0; i < n; i++) {
+        monomial_srs.push_back(g1::affine_element(g1::one * power));
+        power *= x;
+    }
+
+    // Each domain size is converted once, then read from the cache
+    for (size_t size : { n, n / 2 }) {
+        auto domain = evaluation_domain(size);
+        domain.compute_lookup_table();
+        std::vector<g1::affine_element> expected(size);
+        waffle::g1_fft::convert_srs(&monomial_srs[0], &expected[0], domain);
+
+        std::vector<g1::affine_element> lagrange_srs(size);
+        EXPECT_FALSE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+        EXPECT_EQ(lagrange_srs, expected);
+
+        std::fill(lagrange_srs.begin(), lagrange_srs.end(), g1::affine_element());
+        EXPECT_TRUE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+        EXPECT_EQ(lagrange_srs, expected);
+    }
+
+    // A cached SRS converted from other monomial points is not used
+    auto domain = evaluation_domain(n);
+    domain.compute_lookup_table();
+    monomial_srs[n - 1] = g1::affine_element(g1::one);
+    std::vector<g1::affine_element> lagrange_srs(n);
+    EXPECT_FALSE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+    EXPECT_TRUE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+
+    // A cached SRS corrupted on disk is converted again
+    std::FILE* file = std::fopen(cache.path(n).c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, -1, SEEK_END);
+    std::fputc(0x5a, file);
+    std::fclose(file);
+    EXPECT_FALSE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+    EXPECT_TRUE(cache.get(&monomial_srs[0], &lagrange_srs[0], domain));
+
+    std::remove(cache.path(n).c_str());
+    std::remove(cache.path(n / 2).c_str());
+}
+#endif
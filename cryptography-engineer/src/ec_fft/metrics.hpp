@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace waffle {
+namespace g1_fft {
+
+struct round_metrics {
+    uint64_t scalar_multiplications;
+    uint64_t point_additions;
+    uint64_t nanoseconds; // summed over the threads running the round
+
+    bool operator==(round_metrics const&) const = default;
+};
+
+/**
+ * Counters of the work done by the rounds of all the transforms of the process, to be scraped for monitoring: the
+ * round with butterflies of span 2^(r+1) is round r. They are only kept in builds with ENABLE_METRICS: otherwise
+ * counting compiles to nothing and snapshots are empty.
+ */
+namespace metrics {
+
+#ifdef ENABLE_METRICS
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+constexpr size_t MAX_ROUNDS = 32;
+
+struct round_counters {
+    std::atomic<uint64_t> scalar_multiplications;
+    std::atomic<uint64_t> point_additions;
+    std::atomic<uint64_t> nanoseconds;
+};
+
+inline round_counters rounds[MAX_ROUNDS];
+
+inline uint64_t now()
+{
+    if constexpr (enabled) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+    return 0;
+}
+
+// records work done on `round` since `start`, a time given by `now()`
+inline void add_round(size_t round, uint64_t scalar_multiplications, uint64_t point_additions, uint64_t start)
+{
+    if constexpr (enabled) {
+        rounds[round].scalar_multiplications.fetch_add(scalar_multiplications, std::memory_order_relaxed);
+        rounds[round].point_additions.fetch_add(point_additions, std::memory_order_relaxed);
+        rounds[round].nanoseconds.fetch_add(now() - start, std::memory_order_relaxed);
+    }
+}
+
+// the metrics of rounds 0 to the last round that ran
+inline std::vector<round_metrics> snapshot()
+{
+    std::vector<round_metrics> result;
+    for (auto& round : rounds) {
+        result.push_back({ round.scalar_multiplications.load(std::memory_order_relaxed),
+                           round.point_additions.load(std::memory_order_relaxed),
+                           round.nanoseconds.load(std::memory_order_relaxed) });
+    }
+    while (!result.empty() && result.back() == round_metrics{ 0, 0, 0 }) {
+        result.pop_back();
+    }
+    return result;
+}
+
+inline void reset()
+{
+    for (auto& round : rounds) {
+        round.scalar_multiplications.store(0, std::memory_order_relaxed);
+        round.point_additions.store(0, std::memory_order_relaxed);
+        round.nanoseconds.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace metrics
+
+} // namespace g1_fft
+} // namespace waffle
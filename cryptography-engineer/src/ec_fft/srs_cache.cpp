@@ -0,0 +1,166 @@
+#include "srs_cache.hpp"
+#include <crypto/blake3s/blake3s.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#ifndef __wasm__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace waffle {
+namespace g1_fft {
+
+namespace {
+
+constexpr uint64_t CACHE_MAGIC = 0x32726c7466666365; // "ecfftlr2"
+
+/**
+ * Number of points hashed together by a thread.
+ */
+constexpr size_t HASH_CHUNK_SIZE = 1UL << 16;
+
+struct cache_header {
+    uint64_t magic;
+    uint64_t n;
+    transcript_hash hash;        // of the monomial points
+    transcript_hash points_hash; // of the Lagrange points that follow
+};
+
+#ifndef __wasm__
+bool write_all(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool sync_directory(std::string const& directory)
+{
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+#endif
+
+} // namespace
+
+/**
+ * The points are hashed in chunks, in parallel, and the hash is the hash of all the chunk hashes.
+ */
+transcript_hash lagrange_srs_cache::hash_points(const g1::affine_element* points, const size_t n)
+{
+    const size_t num_chunks = (n + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+    std::vector<uint8_t> chunk_hashes(num_chunks * sizeof(transcript_hash));
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < num_chunks; i++) {
+        const size_t chunk_size = std::min(HASH_CHUNK_SIZE, n - i * HASH_CHUNK_SIZE);
+        const auto* begin = reinterpret_cast<const uint8_t*>(&points[i * HASH_CHUNK_SIZE]);
+        std::vector<uint8_t> chunk(begin, begin + chunk_size * sizeof(g1::affine_element));
+        auto chunk_hash = blake3::blake3s(chunk);
+        std::copy(chunk_hash.begin(), chunk_hash.end(), &chunk_hashes[i * sizeof(transcript_hash)]);
+    }
+
+    auto digest = blake3::blake3s(chunk_hashes);
+    transcript_hash hash;
+    std::copy_n(digest.begin(), hash.size(), hash.begin());
+    return hash;
+}
+
+bool lagrange_srs_cache::get(g1::affine_element* monomial_srs,
+                             g1::affine_element* lagrange_srs,
+                             const evaluation_domain& domain) const
+{
+    const transcript_hash hash = hash_points(monomial_srs, domain.size);
+    if (load(hash, domain.size, lagrange_srs)) {
+        return true;
+    }
+
+    convert_srs(monomial_srs, lagrange_srs, domain);
+    store(hash, domain.size, lagrange_srs);
+    return false;
+}
+
+/**
+ * Reads the Lagrange SRS of size `n` converted from the monomial points of hash `hash`. Returns false if the cache does
+ * not hold it, or holds a file whose points do not match the hash in its header, leaving `lagrange_srs` in an
+ * unspecified state.
+ */
+bool lagrange_srs_cache::load(const transcript_hash& hash, const size_t n, g1::affine_element* lagrange_srs) const
+{
+    std::ifstream file(path(n), std::ios::binary);
+    cache_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CACHE_MAGIC ||
+        header.n != n || header.hash != hash) {
+        return false;
+    }
+
+    const auto size = static_cast<std::streamsize>(n * sizeof(g1::affine_element));
+    if (!file.read(reinterpret_cast<char*>(lagrange_srs), size) ||
+        file.peek() != std::ifstream::traits_type::eof()) {
+        return false;
+    }
+    return hash_points(lagrange_srs, n) == header.points_hash;
+}
+
+/**
+ * Writes the Lagrange SRS of size `n` to the cache, replacing any other of that size. The file is written to a
+ * temporary file of its own, synced to disk and renamed into place, so that a concurrent `load` sees either the old
+ * file or the complete new one, and a crash leaves no partial file under the final name. Concurrent stores of the same
+ * size do not mix their contents: the last one renamed wins.
+ */
+bool lagrange_srs_cache::store(const transcript_hash& hash,
+                               const size_t n,
+                               const g1::affine_element* lagrange_srs) const
+{
+    const std::string final_path = path(n);
+    const cache_header header = { CACHE_MAGIC, n, hash, hash_points(lagrange_srs, n) };
+    const auto* points = reinterpret_cast<const char*>(lagrange_srs);
+    const size_t size = n * sizeof(g1::affine_element);
+#ifndef __wasm__
+    std::string temporary_path = final_path + ".XXXXXX";
+    int fd = mkstemp(temporary_path.data());
+    if (fd < 0) {
+        return false;
+    }
+    const bool written = write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+                         write_all(fd, points, size) && fsync(fd) == 0;
+    ::close(fd);
+    // the temporary file must be on disk under its own name before it replaces the old one, and the rename after
+    if (!written || !sync_directory(directory_) || std::rename(temporary_path.c_str(), final_path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        return false;
+    }
+    return sync_directory(directory_);
+#else
+    // a single process writes the cache on WASM
+    const std::string temporary_path = final_path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(points, static_cast<std::streamsize>(size));
+        if (!file.flush()) {
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+    }
+    return std::rename(temporary_path.c_str(), final_path.c_str()) == 0;
+#endif
+}
+
+} // namespace g1_fft
+} // namespace waffle
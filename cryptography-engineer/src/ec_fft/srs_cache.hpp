@@ -0,0 +1,47 @@
+#pragma once
+#include "ec_fft.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace waffle {
+namespace g1_fft {
+
+using transcript_hash = std::array<uint8_t, 32>;
+
+/**
+ * A directory of Lagrange SRS files, one per domain size, each tagged with the hash of the monomial points it was
+ * converted from. A file holds a header {magic, n, hash, points hash} followed by the n raw `g1::affine_element`s,
+ * whose own hash is the points hash.
+ *
+ * Smaller domains are not derived from the file of a larger one: the Lagrange basis of a subgroup is not a combination
+ * of a few points of the basis of the larger group, and getting it from there costs at least a transform of its own
+ * size, which is what converting the first points of the monomial SRS takes.
+ */
+class lagrange_srs_cache {
+  public:
+    explicit lagrange_srs_cache(std::string const& directory)
+        : directory_(directory)
+    {}
+
+    /**
+     * Fills `lagrange_srs` with the Lagrange SRS of `domain` converted from `monomial_srs`, as `convert_srs` would.
+     * It is read from the cache if it holds one converted from the same points, and converted and stored otherwise.
+     *
+     * @return whether it was read from the cache
+     */
+    bool get(g1::affine_element* monomial_srs, g1::affine_element* lagrange_srs, const evaluation_domain& domain) const;
+
+    bool load(const transcript_hash& hash, const size_t n, g1::affine_element* lagrange_srs) const;
+    bool store(const transcript_hash& hash, const size_t n, const g1::affine_element* lagrange_srs) const;
+
+    std::string path(const size_t n) const { return directory_ + "/lagrange_" + std::to_string(n) + ".srs"; }
+
+    static transcript_hash hash_points(const g1::affine_element* points, const size_t n);
+
+  private:
+    std::string directory_;
+};
+
+} // namespace g1_fft
+} // namespace waffle
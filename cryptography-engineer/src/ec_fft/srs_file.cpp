@@ -0,0 +1,467 @@
+#include "srs_file.hpp"
+#include "twiddles.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifndef __wasm__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace waffle {
+namespace g1_fft {
+
+namespace {
+
+constexpr uint64_t PROGRESS_MAGIC = 0x7372737466666365; // "ecfftsrs"
+
+/**
+ * Number of points multiplied by their twiddles and normalized together by a thread.
+ */
+constexpr size_t TWIDDLE_CHUNK_SIZE = 1024;
+
+/**
+ * A file read (and written, if `writable`) at given byte offsets. A writable file is created if it does not exist. Not
+ * available on WASM, where it is never open.
+ */
+class raw_file {
+  public:
+    raw_file(std::string const& path, bool writable)
+    {
+#ifndef __wasm__
+        fd_ = writable ? ::open(path.c_str(), O_RDWR | O_CREAT, 0644) : ::open(path.c_str(), O_RDONLY);
+#else
+        static_cast<void>(path);
+        static_cast<void>(writable);
+#endif
+    }
+
+    ~raw_file()
+    {
+#ifndef __wasm__
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    raw_file(raw_file const&) = delete;
+    raw_file& operator=(raw_file const&) = delete;
+
+    bool is_open() const { return fd_ >= 0; }
+
+    size_t size() const
+    {
+#ifndef __wasm__
+        struct stat st;
+        return fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+#else
+        return 0;
+#endif
+    }
+
+    bool read(void* data, size_t size, size_t offset) const
+    {
+#ifndef __wasm__
+        auto* ptr = static_cast<uint8_t*>(data);
+        while (size > 0) {
+            ssize_t count = pread(fd_, ptr, size, static_cast<off_t>(offset));
+            if (count <= 0) {
+                return false;
+            }
+            ptr += count;
+            size -= static_cast<size_t>(count);
+            offset += static_cast<size_t>(count);
+        }
+        return true;
+#else
+        static_cast<void>(data);
+        return size == 0 && offset == 0;
+#endif
+    }
+
+    bool write(const void* data, size_t size, size_t offset) const
+    {
+#ifndef __wasm__
+        const auto* ptr = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            ssize_t count = pwrite(fd_, ptr, size, static_cast<off_t>(offset));
+            if (count <= 0) {
+                return false;
+            }
+            ptr += count;
+            size -= static_cast<size_t>(count);
+            offset += static_cast<size_t>(count);
+        }
+        return true;
+#else
+        static_cast<void>(data);
+        return size == 0 && offset == 0;
+#endif
+    }
+
+    // wait for the written data to be on disk
+    bool sync() const
+    {
+#ifndef __wasm__
+        return fsync(fd_) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // cut the file to `size` bytes, or extend it with zeros
+    bool resize(size_t size) const
+    {
+#ifndef __wasm__
+        return ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#else
+        return size == 0;
+#endif
+    }
+
+  private:
+    int fd_ = -1;
+};
+
+/**
+ * Points in memory, read (and written, if not `const`) at given byte offsets like a `raw_file`.
+ */
+class memory_region {
+  public:
+    explicit memory_region(const g1::affine_element* points)
+        : data_(reinterpret_cast<const uint8_t*>(points))
+    {}
+
+    explicit memory_region(g1::affine_element* points)
+        : data_(reinterpret_cast<const uint8_t*>(points))
+        , writable_data_(reinterpret_cast<uint8_t*>(points))
+    {}
+
+    bool read(void* data, size_t size, size_t offset) const
+    {
+        std::memcpy(data, data_ + offset, size);
+        return true;
+    }
+
+    bool write(const void* data, size_t size, size_t offset) const
+    {
+        ASSERT(writable_data_ != nullptr);
+        std::memcpy(writable_data_ + offset, data, size);
+        return true;
+    }
+
+  private:
+    const uint8_t* data_;
+    uint8_t* writable_data_ = nullptr;
+};
+
+/**
+ * Contents of the progress file: the pass being run (1 or 2), and the number of its columns already written.
+ */
+struct progress {
+    uint64_t magic;
+    uint64_t n;
+    uint64_t pass;
+    uint64_t done;
+};
+
+/**
+ * Reads the columns `first` to `first + count` of the matrix of `num_rows` rows of `num_columns` points stored in
+ * `file`, one column after the other in `columns`.
+ */
+template <typename Storage>
+bool read_columns(const Storage& file,
+                  const size_t num_rows,
+                  const size_t num_columns,
+                  const size_t first,
+                  const size_t count,
+                  g1::affine_element* columns)
+{
+    std::vector<g1::affine_element> row(count);
+    for (size_t r = 0; r < num_rows; r++) {
+        size_t offset = (r * num_columns + first) * sizeof(g1::affine_element);
+        if (!file.read(&row[0], count * sizeof(g1::affine_element), offset)) {
+            return false;
+        }
+        for (size_t c = 0; c < count; c++) {
+            columns[c * num_rows + r] = row[c];
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes back columns read by `read_columns`.
+ */
+template <typename Storage>
+bool write_columns(const Storage& file,
+                   const size_t num_rows,
+                   const size_t num_columns,
+                   const size_t first,
+                   const size_t count,
+                   const g1::affine_element* columns)
+{
+    std::vector<g1::affine_element> row(count);
+    for (size_t r = 0; r < num_rows; r++) {
+        for (size_t c = 0; c < count; c++) {
+            row[c] = columns[c * num_rows + r];
+        }
+        size_t offset = (r * num_columns + first) * sizeof(g1::affine_element);
+        if (!file.write(&row[0], count * sizeof(g1::affine_element), offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Multiplies the points of `column` by scale·ω⁰, scale·ω¹, ..., scale·ωᵏ⁻¹.
+ */
+void multiply_by_powers(g1::affine_element* column, const size_t k, const fr& omega, const fr& scale)
+{
+    const size_t num_chunks = (k + TWIDDLE_CHUNK_SIZE - 1) / TWIDDLE_CHUNK_SIZE;
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+    for (size_t j = 0; j < num_chunks; j++) {
+        const size_t start = j * TWIDDLE_CHUNK_SIZE;
+        const size_t chunk_size = std::min(TWIDDLE_CHUNK_SIZE, k - start);
+        std::vector<g1::element> chunk(chunk_size);
+
+        fr power = scale * omega.pow(static_cast<uint64_t>(start));
+        for (size_t i = 0; i < chunk_size; i++) {
+            chunk[i] = twiddle::recode(power) * g1::element(column[start + i]);
+            power *= omega;
+        }
+        g1::element::batch_normalize(&chunk[0], chunk_size);
+        for (size_t i = 0; i < chunk_size; i++) {
+            column[start + i] = g1::affine_element(chunk[i].x, chunk[i].y);
+        }
+    }
+}
+
+/**
+ * Splits a transform of size n into n₁·n₂ points, with n₂ = 2^⌈log2(n)/2⌉ (see `convert_srs_file`).
+ */
+size_t column_size(const size_t n)
+{
+    return 1UL << ((numeric::get_msb(static_cast<uint64_t>(n)) + 1) / 2);
+}
+
+struct four_step_plan {
+    explicit four_step_plan(const size_t n)
+        : n2(column_size(n))
+        , n1(n / n2)
+        , row_domain(n1)
+        , column_domain(n2)
+    {
+        ASSERT(n >= 4 && !(n & (n - 1)));
+        row_domain.compute_lookup_table();
+        column_domain.compute_lookup_table();
+    }
+
+    size_t n2;
+    size_t n1;
+    evaluation_domain row_domain;
+    evaluation_domain column_domain;
+};
+
+/**
+ * First pass over the `count` columns of the monomial SRS read from column `first`: their inverse FFTs over ω₂, scaled.
+ */
+void transform_first_pass(g1::affine_element* columns,
+                          const size_t first,
+                          const size_t count,
+                          const four_step_plan& plan,
+                          const evaluation_domain& domain)
+{
+    for (size_t c = 0; c < count; c++) {
+        g1::affine_element* column = &columns[c * plan.n2];
+        ec_fft_inner_affine(column, plan.n2, plan.column_domain.get_inverse_round_roots());
+        multiply_by_powers(column, plan.n2, domain.root_inverse.pow(first + c), domain.domain_inverse);
+    }
+}
+
+/**
+ * Second pass over `count` columns of the intermediate matrix: their inverse FFTs over ω₁.
+ */
+void transform_second_pass(g1::affine_element* columns, const size_t count, const four_step_plan& plan)
+{
+    for (size_t c = 0; c < count; c++) {
+        ec_fft_inner_affine(&columns[c * plan.n1], plan.n1, plan.row_domain.get_inverse_round_roots());
+    }
+}
+
+} // namespace
+
+/**
+ * With the monomial points x_j at j = j₁ + n₁·j₂ and the Lagrange points y_i at i = i₂ + n₂·i₁, that is with the
+ * monomial SRS seen as n₂ rows of n₁ points and the Lagrange SRS as n₁ rows of n₂ points,
+ *
+ *     y_i = 1/n · Σ_j ω⁻ⁱʲ·x_j = Σ_j₁ ω₁⁻ⁱ¹ʲ¹ · (1/n · ω⁻ⁱ²ʲ¹ · Σ_j₂ ω₂⁻ⁱ²ʲ² · x_j)
+ *
+ * where ω₁ = ωⁿ² and ω₂ = ωⁿ¹. The first pass computes the inner sums, the inverse FFTs over ω₂ of the columns of the
+ * monomial SRS, scales them and writes them in the rows of the intermediate file. The second pass computes the outer
+ * sums, the inverse FFTs over ω₁ of the columns of the intermediate file, which are the columns of the Lagrange SRS.
+ */
+conversion_status convert_srs_file(std::string const& monomial_path,
+                                   std::string const& lagrange_path,
+                                   const evaluation_domain& domain,
+                                   const size_t max_points,
+                                   const size_t max_batches)
+{
+    const size_t n = domain.size;
+    const four_step_plan plan(n);
+    const size_t n1 = plan.n1;
+    const size_t n2 = plan.n2;
+    ASSERT(max_points >= n2);
+
+    const std::string pass_path = lagrange_path + ".pass";
+    const std::string progress_path = lagrange_path + ".progress";
+    raw_file monomial(monomial_path, false);
+    if (!monomial.is_open() || monomial.size() < n * sizeof(g1::affine_element)) {
+        return conversion_status::FAILED;
+    }
+    raw_file intermediate(pass_path, true);
+    raw_file lagrange(lagrange_path, true);
+    raw_file progress_file(progress_path, true);
+    if (!intermediate.is_open() || !lagrange.is_open() || !progress_file.is_open()) {
+        return conversion_status::FAILED;
+    }
+    // an older, larger file must not keep its tail past the n points, the points already written by a conversion
+    // being resumed are kept
+    if (!lagrange.resize(n * sizeof(g1::affine_element))) {
+        return conversion_status::FAILED;
+    }
+
+    // resume a conversion of the same size, start over otherwise
+    progress state = { PROGRESS_MAGIC, n, 1, 0 };
+    progress saved;
+    if (progress_file.size() == sizeof(saved) && progress_file.read(&saved, sizeof(saved), 0) &&
+        saved.magic == PROGRESS_MAGIC && saved.n == n && (saved.pass == 1 || saved.pass == 2)) {
+        state = saved;
+    }
+
+    std::vector<g1::affine_element> columns(std::min(max_points, n));
+    size_t num_batches = 0;
+
+    while (state.pass == 1 && state.done < n1) {
+        if (num_batches++ == max_batches) {
+            return conversion_status::INCOMPLETE;
+        }
+        const size_t count = std::min(max_points / n2, n1 - state.done);
+        if (!read_columns(monomial, n2, n1, state.done, count, &columns[0])) {
+            return conversion_status::FAILED;
+        }
+        transform_first_pass(&columns[0], state.done, count, plan, domain);
+
+        const size_t offset = state.done * n2 * sizeof(g1::affine_element);
+        if (!intermediate.write(&columns[0], count * n2 * sizeof(g1::affine_element), offset) || !intermediate.sync()) {
+            return conversion_status::FAILED;
+        }
+        state.done += count;
+        if (state.done == n1) {
+            state.pass = 2;
+            state.done = 0;
+        }
+        if (!progress_file.write(&state, sizeof(state), 0) || !progress_file.sync()) {
+            return conversion_status::FAILED;
+        }
+    }
+
+    while (state.pass == 2 && state.done < n2) {
+        if (num_batches++ == max_batches) {
+            return conversion_status::INCOMPLETE;
+        }
+        const size_t count = std::min(max_points / n1, n2 - state.done);
+        if (!read_columns(intermediate, n1, n2, state.done, count, &columns[0])) {
+            return conversion_status::FAILED;
+        }
+        transform_second_pass(&columns[0], count, plan);
+
+        if (!write_columns(lagrange, n1, n2, state.done, count, &columns[0]) || !lagrange.sync()) {
+            return conversion_status::FAILED;
+        }
+        state.done += count;
+        if (!progress_file.write(&state, sizeof(state), 0) || !progress_file.sync()) {
+            return conversion_status::FAILED;
+        }
+    }
+
+    std::remove(pass_path.c_str());
+    std::remove(progress_path.c_str());
+    return conversion_status::COMPLETE;
+}
+
+/**
+ * The passes of `convert_srs_file` run in memory: the intermediate matrix is built in `lagrange_srs` itself, as the
+ * second pass writes every column back where it read it from.
+ */
+bool convert_srs_chunked(const g1::affine_element* monomial_srs,
+                         g1::affine_element* lagrange_srs,
+                         const evaluation_domain& domain,
+                         const size_t max_points,
+                         async::task_control* control)
+{
+    const size_t n = domain.size;
+    const four_step_plan plan(n);
+    const size_t n1 = plan.n1;
+    const size_t n2 = plan.n2;
+    ASSERT(max_points >= n2);
+
+    const memory_region monomial(monomial_srs);
+    const memory_region lagrange(lagrange_srs);
+    std::vector<g1::affine_element> columns(std::min(max_points, n));
+    if (control) {
+        control->set_total(n1 + n2);
+    }
+
+    for (size_t done = 0; done < n1;) {
+        if (control && control->is_cancelled()) {
+            return false;
+        }
+        const size_t count = std::min(max_points / n2, n1 - done);
+        read_columns(monomial, n2, n1, done, count, &columns[0]);
+        transform_first_pass(&columns[0], done, count, plan, domain);
+        lagrange.write(&columns[0], count * n2 * sizeof(g1::affine_element), done * n2 * sizeof(g1::affine_element));
+        done += count;
+        if (control) {
+            control->advance(count);
+        }
+    }
+
+    for (size_t done = 0; done < n2;) {
+        if (control && control->is_cancelled()) {
+            return false;
+        }
+        const size_t count = std::min(max_points / n1, n2 - done);
+        read_columns(lagrange, n1, n2, done, count, &columns[0]);
+        transform_second_pass(&columns[0], count, plan);
+        write_columns(lagrange, n1, n2, done, count, &columns[0]);
+        done += count;
+        if (control) {
+            control->advance(count);
+        }
+    }
+    return true;
+}
+
+std::future<bool> convert_srs_async(async::task_pool& pool,
+                                    const g1::affine_element* monomial_srs,
+                                    g1::affine_element* lagrange_srs,
+                                    const evaluation_domain& domain,
+                                    std::shared_ptr<async::task_control> control)
+{
+    const size_t n = domain.size;
+    const size_t budget = MEMORY_BUDGET / sizeof(g1::affine_element);
+    const size_t max_points = std::max(column_size(n), std::min(n / ASYNC_BATCHES_PER_PASS, budget));
+    return pool.submit([=, &domain]() {
+        return convert_srs_chunked(monomial_srs, lagrange_srs, domain, max_points, control.get());
+    });
+}
+
+} // namespace g1_fft
+} // namespace waffle
@@ -0,0 +1,65 @@
+#pragma once
+#include "ec_fft.hpp"
+#include <async/task_control.hpp>
+#include <async/task_pool.hpp>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+
+namespace waffle {
+namespace g1_fft {
+
+enum class conversion_status { COMPLETE, INCOMPLETE, FAILED };
+
+/**
+ * Computes the same Lagrange SRS as `convert_srs`, reading the monomial SRS from the file at `monomial_path` and
+ * writing the Lagrange SRS to the file at `lagrange_path`, with about `max_points` points in memory at any time.
+ * Both files hold raw `g1::affine_element`s, the monomial one at least n = domain.size of them. The domain does not
+ * need its lookup tables.
+ *
+ * The transform is a four-step FFT over n = n₁·n₂ points, with n₂ = 2^⌈log2(n)/2⌉: a first pass over the monomial file
+ * transforms its n₁ columns of n₂ points and writes them to `lagrange_path` + ".pass", a second pass transforms the
+ * n₂ columns of n₁ points of the intermediate file and writes the result. Each pass reads and writes every point once,
+ * whole columns at a time, as many as fit in `max_points`, which must therefore be at least n₂.
+ *
+ * The progress is saved in `lagrange_path` + ".progress" after every batch of columns, and a conversion of the same
+ * domain size resumes from there. At most `max_batches` batches are run per call: INCOMPLETE means there are more to
+ * run, FAILED that a file could not be read or written. Once COMPLETE, both temporary files are removed.
+ */
+conversion_status convert_srs_file(std::string const& monomial_path,
+                                   std::string const& lagrange_path,
+                                   const evaluation_domain& domain,
+                                   const size_t max_points,
+                                   const size_t max_batches = SIZE_MAX);
+
+/**
+ * Computes the same Lagrange SRS as `convert_srs` with the schedule of `convert_srs_file`, in memory: on top of the two
+ * SRS buffers, it only holds `max_points` points (at least n₂) and the twiddles of sizes n₁ and n₂, about 2·√n of them.
+ * The domain does not need its lookup tables.
+ *
+ * With a `control`, the conversion counts its columns, n₁ + n₂ in all, as its progress, and gives up between two
+ * batches of columns once cancelled, returning false with `lagrange_srs` partly written.
+ */
+bool convert_srs_chunked(const g1::affine_element* monomial_srs,
+                         g1::affine_element* lagrange_srs,
+                         const evaluation_domain& domain,
+                         const size_t max_points,
+                         async::task_control* control = nullptr);
+
+// batches per pass of a conversion scheduled by `convert_srs_async`, unless a column is larger
+constexpr size_t ASYNC_BATCHES_PER_PASS = 16;
+
+/**
+ * Schedules `convert_srs_chunked` on `pool`, within `MEMORY_BUDGET` and with batches small enough for `control` to
+ * follow the progress and for a cancellation to be heard soon. The future returns false if the conversion was
+ * cancelled. The SRS buffers and the domain must outlive the task.
+ */
+std::future<bool> convert_srs_async(async::task_pool& pool,
+                                    const g1::affine_element* monomial_srs,
+                                    g1::affine_element* lagrange_srs,
+                                    const evaluation_domain& domain,
+                                    std::shared_ptr<async::task_control> control = nullptr);
+
+} // namespace g1_fft
+} // namespace waffle
@@ -0,0 +1,216 @@
+#include "twiddles.hpp"
+#include <algorithm>
+#include <map>
+#ifndef NO_MULTITHREADING
+#include <omp.h>
+#endif
+
+namespace waffle {
+namespace g1_fft {
+
+namespace {
+
+/**
+ * Writes the odd integer `k` < 2^129 as Σ dᵢ·2^(4i) with odd digits |dᵢ| < 16.
+ */
+void recode_odd(uint256_t k, std::array<int8_t, twiddle::NUM_WINDOWS>& digits)
+{
+    constexpr uint64_t window_mask = (1UL << (twiddle::WINDOW_BITS + 1)) - 1;
+    constexpr int64_t half_window = 1L << twiddle::WINDOW_BITS;
+    for (size_t i = 0; i < twiddle::NUM_WINDOWS - 1; i++) {
+        // keeps k odd: k - d ≡ 2^w (mod 2^(w + 1))
+        int64_t digit = static_cast<int64_t>(k.data[0] & window_mask) - half_window;
+        k = digit >= 0 ? k - uint256_t(static_cast<uint64_t>(digit)) : k + uint256_t(static_cast<uint64_t>(-digit));
+        k = k >> twiddle::WINDOW_BITS;
+        digits[i] = static_cast<int8_t>(digit);
+    }
+    ASSERT(k < uint256_t(static_cast<uint64_t>(half_window)));
+    digits[twiddle::NUM_WINDOWS - 1] = static_cast<int8_t>(k.data[0]);
+}
+
+fr decode(const std::array<int8_t, twiddle::NUM_WINDOWS>& digits, const bool skew)
+{
+    fr result = 0;
+    for (size_t i = twiddle::NUM_WINDOWS; i > 0; i--) {
+        auto digit = digits[i - 1];
+        result *= fr(1UL << twiddle::WINDOW_BITS);
+        result += digit >= 0 ? fr(static_cast<uint64_t>(digit)) : -fr(static_cast<uint64_t>(-digit));
+    }
+    return skew ? result - fr::one() : result;
+}
+
+/**
+ * Odd multiples P, 3P, ..., (2 * TABLE_SIZE - 1)P of `point`.
+ */
+void compute_odd_multiples(const g1::element& point, std::array<g1::element, twiddle::TABLE_SIZE>& table)
+{
+    g1::element point_dbl = point.dbl();
+    table[0] = point;
+    for (size_t i = 1; i < twiddle::TABLE_SIZE; i++) {
+        table[i] = table[i - 1] + point_dbl;
+    }
+}
+
+inline g1::element lookup(const std::array<g1::element, twiddle::TABLE_SIZE>& table, const int8_t digit)
+{
+    return digit >= 0 ? table[static_cast<size_t>(digit) >> 1] : -table[static_cast<size_t>(-digit) >> 1];
+}
+
+} // namespace
+
+twiddle twiddle::recode(const fr& root)
+{
+    twiddle result;
+    result.is_one = root == fr::one();
+
+    fr k1;
+    fr k2;
+    fr::split_into_endomorphism_scalars(root.from_montgomery_form(), k1, k2);
+    uint256_t k1_value(k1.data[0], k1.data[1], 0, 0);
+    uint256_t k2_value(k2.data[0], k2.data[1], 0, 0);
+
+    result.k1_skew = !(k1_value.data[0] & 1);
+    result.k2_skew = !(k2_value.data[0] & 1);
+    recode_odd(result.k1_skew ? k1_value + uint256_t(1) : k1_value, result.k1_digits);
+    recode_odd(result.k2_skew ? k2_value + uint256_t(1) : k2_value, result.k2_digits);
+
+    // the digits must give back the root
+    const fr decoded_k1 = decode(result.k1_digits, result.k1_skew);
+    const fr decoded_k2 = decode(result.k2_digits, result.k2_skew);
+    ASSERT(decoded_k1 - fr::cube_root_of_unity() * decoded_k2 == root);
+    return result;
+}
+
+g1::element twiddle::operator*(const g1::element& point) const
+{
+    if (is_one) {
+        return point;
+    }
+
+    // odd multiples of P and of -λ·P = (β·x, -y), as k₂ is subtracted
+    std::array<g1::element, TABLE_SIZE> table;
+    std::array<g1::element, TABLE_SIZE> endo_table;
+    compute_odd_multiples(point, table);
+    const fq beta = fq::cube_root_of_unity();
+    for (size_t i = 0; i < TABLE_SIZE; i++) {
+        endo_table[i] = g1::element(table[i].x * beta, -table[i].y, table[i].z);
+    }
+
+    g1::element result = lookup(table, k1_digits[NUM_WINDOWS - 1]) + lookup(endo_table, k2_digits[NUM_WINDOWS - 1]);
+    for (size_t i = NUM_WINDOWS - 1; i > 0; i--) {
+        for (size_t j = 0; j < WINDOW_BITS; j++) {
+            result.self_dbl();
+        }
+        result += lookup(table, k1_digits[i - 1]);
+        result += lookup(endo_table, k2_digits[i - 1]);
+    }
+
+    if (k1_skew) {
+        result -= table[0];
+    }
+    if (k2_skew) {
+        result -= endo_table[0];
+    }
+    return result;
+}
+
+std::shared_ptr<const std::vector<twiddle>> recode_round_twiddles(const fr* round_roots,
+                                                                  const size_t m,
+                                                                  const fr& scale)
+{
+    auto recoded = std::make_shared<std::vector<twiddle>>(m);
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < m; i++) {
+        (*recoded)[i] = twiddle::recode(scale * round_roots[i]);
+    }
+    return recoded;
+}
+
+namespace {
+
+struct cached_round {
+    std::shared_ptr<const std::vector<twiddle>> twiddles;
+    uint64_t last_use;
+};
+
+// rounds are told apart by ω₂ₘ, which is never 1
+std::map<uint256_t, cached_round> round_cache;
+size_t round_cache_size = 0;
+uint64_t round_cache_clock = 0;
+
+} // namespace
+
+std::shared_ptr<const std::vector<twiddle>> get_round_twiddles(const fr* round_roots, const size_t m)
+{
+    const uint256_t key(round_roots[1]);
+
+    std::shared_ptr<const std::vector<twiddle>> twiddles;
+#ifndef NO_MULTITHREADING
+#pragma omp critical(ec_fft_twiddles)
+#endif
+    {
+        auto it = round_cache.find(key);
+        if (it != round_cache.end()) {
+            it->second.last_use = ++round_cache_clock;
+            twiddles = it->second.twiddles;
+        }
+    }
+    if (twiddles) {
+        ASSERT(twiddles->size() == m);
+        return twiddles;
+    }
+
+    twiddles = recode_round_twiddles(round_roots, m, fr::one());
+    if (m > ROUND_TWIDDLES_CAPACITY) {
+        return twiddles;
+    }
+
+#ifndef NO_MULTITHREADING
+#pragma omp critical(ec_fft_twiddles)
+#endif
+    {
+        auto it = round_cache.find(key);
+        if (it != round_cache.end()) {
+            // another thread has recoded the same round meanwhile, keep a single copy
+            it->second.last_use = ++round_cache_clock;
+            twiddles = it->second.twiddles;
+        } else {
+            while (round_cache_size + m > ROUND_TWIDDLES_CAPACITY) {
+                auto oldest = std::min_element(round_cache.begin(), round_cache.end(), [](auto& a, auto& b) {
+                    return a.second.last_use < b.second.last_use;
+                });
+                round_cache_size -= oldest->second.twiddles->size();
+                round_cache.erase(oldest);
+            }
+            round_cache.emplace(key, cached_round{ twiddles, ++round_cache_clock });
+            round_cache_size += m;
+        }
+    }
+    return twiddles;
+}
+
+size_t cached_round_twiddles()
+{
+    size_t size;
+#ifndef NO_MULTITHREADING
+#pragma omp critical(ec_fft_twiddles)
+#endif
+    size = round_cache_size;
+    return size;
+}
+
+void clear_round_twiddles()
+{
+#ifndef NO_MULTITHREADING
+#pragma omp critical(ec_fft_twiddles)
+#endif
+    {
+        round_cache.clear();
+        round_cache_size = 0;
+    }
+}
+
+} // namespace g1_fft
+} // namespace waffle
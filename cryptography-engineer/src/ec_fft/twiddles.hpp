@@ -0,0 +1,72 @@
+#pragma once
+#include <ecc/curves/bn254/g1.hpp>
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace waffle {
+namespace g1_fft {
+
+using namespace barretenberg;
+
+/**
+ * A twiddle factor (root of unity) of the EC-FFT butterfly, recoded once so that multiplying a point by it is cheap.
+ *
+ * The root ω is split with the curve endomorphism as ω = k₁ - λ·k₂ with 128-bit k₁, k₂, where λ·(x, y) = (β·x, y).
+ * Both halves are recoded into signed odd digits in base 2^`WINDOW_BITS`, least significant first (an even half is
+ * recoded plus one, and the point is subtracted back at the end). A multiplication is then 128 doublings shared by both
+ * halves, plus two additions from small tables of odd multiples every `WINDOW_BITS` doublings.
+ */
+struct twiddle {
+    static constexpr size_t WINDOW_BITS = 4;
+    static constexpr size_t NUM_WINDOWS = 33;
+    static constexpr size_t TABLE_SIZE = 1UL << (WINDOW_BITS - 1);
+
+    std::array<int8_t, NUM_WINDOWS> k1_digits;
+    std::array<int8_t, NUM_WINDOWS> k2_digits;
+    bool k1_skew;
+    bool k2_skew;
+    bool is_one;
+
+    static twiddle recode(const fr& root);
+
+    g1::element operator*(const g1::element& point) const;
+};
+
+/**
+ * Most twiddles kept by `get_round_twiddles`: about 140MB, the rounds of a transform and of its inverse of 2^20 points.
+ */
+constexpr size_t ROUND_TWIDDLES_CAPACITY = 1UL << 21;
+
+/**
+ * Returns the recoded twiddles c·ω₂ₘ⁰, ..., c·ω₂ₘᵐ⁻¹ of the round with butterflies of span 2m, given the values
+ * ω₂ₘ^i `round_roots` (i.e. an entry of `evaluation_domain::get_round_roots()` or of the inverse round roots) and the
+ * scale c. They are recoded on every call.
+ */
+std::shared_ptr<const std::vector<twiddle>> recode_round_twiddles(const fr* round_roots,
+                                                                  const size_t m,
+                                                                  const fr& scale);
+
+/**
+ * Returns the recoded twiddles ω₂ₘ⁰, ..., ω₂ₘᵐ⁻¹ of the round with butterflies of span 2m, as `recode_round_twiddles`
+ * without a scale.
+ *
+ * These only depend on ω₂ₘ, not on the size of the domain: the twiddles of a given round are recoded the first time
+ * they are needed and the result is shared by every later transform, whatever its size. At most
+ * `ROUND_TWIDDLES_CAPACITY` twiddles are kept, the least recently used rounds being dropped first; a transform still
+ * using a dropped round keeps it until it is done.
+ */
+std::shared_ptr<const std::vector<twiddle>> get_round_twiddles(const fr* round_roots, const size_t m);
+
+/**
+ * Number of twiddles kept by `get_round_twiddles`.
+ */
+size_t cached_round_twiddles();
+
+/**
+ * Drops all the twiddles kept by `get_round_twiddles`.
+ */
+void clear_round_twiddles();
+
+} // namespace g1_fft
+} // namespace waffle
@@ -0,0 +1,146 @@
+#pragma once
+#include <common/assert.hpp>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifndef __wasm__
+#include <sys/mman.h>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Append-only array with a capacity fixed at construction.
+ *
+ * The whole capacity is reserved as virtual memory up front and pages are only committed once they are written to, so
+ * the arena can be sized for the largest possible tree without paying for it, and elements never move as it grows.
+ * Where no such reservation can be made (e.g. on WASM) it falls back to a heap vector that grows on demand.
+ *
+ * An arena can also be laid over memory owned by someone else, such as a memory mapped file, that already holds `size`
+ * elements. A copy of an arena always owns its memory.
+ */
+template <typename T> class arena {
+    static_assert(std::is_trivially_copyable_v<T>, "arena elements are copied and mapped as raw memory");
+
+  public:
+    explicit arena(size_t capacity)
+        : capacity_(capacity)
+    {
+#ifndef __wasm__
+        void* ptr = mmap(
+            nullptr, capacity_ * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr != MAP_FAILED) {
+            data_ = static_cast<T*>(ptr);
+            mapped_ = true;
+        }
+#endif
+    }
+
+    arena(T* data, size_t size, size_t capacity)
+        : data_(data)
+        , size_(size)
+        , capacity_(capacity)
+        , mapped_(true)
+        , owned_(false)
+    {
+        ASSERT(size_ <= capacity_);
+    }
+
+    arena(arena const& other)
+        : arena(other.capacity_)
+    {
+        for (size_t i = 0; i < other.size_; i++) {
+            push_back(other[i]);
+        }
+    }
+
+    arena(arena&& other) noexcept
+        : capacity_(0)
+    {
+        swap(other);
+    }
+
+    arena& operator=(arena const& other)
+    {
+        if (this != &other) {
+            arena copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    arena& operator=(arena&& other) noexcept
+    {
+        if (this != &other) {
+            arena moved(std::move(other));
+            swap(moved);
+        }
+        return *this;
+    }
+
+    ~arena()
+    {
+#ifndef __wasm__
+        if (mapped_ && owned_) {
+            munmap(data_, capacity_ * sizeof(T));
+        }
+#endif
+    }
+
+    void push_back(T const& value)
+    {
+        ASSERT(size_ < capacity_);
+        if (!mapped_) {
+            heap_.push_back(value);
+            data_ = heap_.data();
+        } else {
+            std::memcpy(static_cast<void*>(data_ + size_), &value, sizeof(T));
+        }
+        size_++;
+    }
+
+    // Drop the elements past the first `size`
+    void truncate(size_t size)
+    {
+        ASSERT(size <= size_);
+        if (!mapped_) {
+            heap_.resize(size);
+            data_ = heap_.data();
+        }
+        size_ = size;
+    }
+
+    T& operator[](size_t index) { return data_[index]; }
+    T const& operator[](size_t index) const { return data_[index]; }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+
+  private:
+    void swap(arena& other)
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(mapped_, other.mapped_);
+        std::swap(owned_, other.owned_);
+        heap_.swap(other.heap_);
+    }
+
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_;
+    // whether `data_` is a fixed reservation, and whether it must be released by this arena
+    bool mapped_ = false;
+    bool owned_ = true;
+
+    // fallback storage when the capacity could not be reserved up front
+    std::vector<T> heap_;
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
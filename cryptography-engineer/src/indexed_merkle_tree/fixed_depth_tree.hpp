@@ -0,0 +1,65 @@
+#pragma once
+#include "indexed_merkle_tree.hpp"
+#include <array>
+#include <utility>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * An IndexedMerkleTree whose depth is known at compile time. Updates, checkpoints and every other operation are those
+ * of IndexedMerkleTree, while hash paths are read into a `std::array`, without allocating, by a loop unrolled over the
+ * levels. In a dense tree with no checkpoint open, each level is then read at a constant offset of the node array.
+ */
+template <size_t Depth, typename Hasher = pedersen_hasher>
+class FixedDepthIndexedMerkleTree : public IndexedMerkleTree<Hasher> {
+    static_assert(Depth >= 1 && Depth <= MAX_TREE_DEPTH);
+
+  public:
+    static constexpr size_t depth = Depth;
+
+    using hash_path = std::array<std::pair<fr, fr>, Depth>;
+
+    explicit FixedDepthIndexedMerkleTree(storage_mode mode = default_storage_mode(Depth))
+        : IndexedMerkleTree<Hasher>(Depth, mode)
+    {}
+
+    // Position of the first node of `level` in the array of a dense tree, after the 2^Depth + ... + 2^(Depth-level+1)
+    // nodes of the levels below
+    static constexpr size_t level_offset(size_t level)
+    {
+        return static_cast<size_t>((uint64_t{ 2 } << Depth) - (uint64_t{ 2 } << (Depth - level)));
+    }
+
+    // Same path as `IndexedMerkleTree::get_hash_path`
+    hash_path get_hash_path(size_t index) const
+    {
+        hash_path path;
+        fr const* nodes = this->dense_nodes();
+        if (nodes != nullptr) {
+            read_levels([&]<size_t L>() {
+                fr const* pair = nodes + level_offset(L) + ((index >> L) & ~1UL);
+                path[L] = std::make_pair(pair[0], pair[1]);
+            });
+        } else {
+            read_levels([&]<size_t L>() {
+                path[L] = std::make_pair(this->get_node(L, (index >> L) & ~1UL), this->get_node(L, (index >> L) | 1UL));
+            });
+        }
+        return path;
+    }
+
+  private:
+    // calls `read.template operator()<L>()` for every level L, from the leaves up
+    template <typename F> static void read_levels(F&& read)
+    {
+        [&]<size_t... L>(std::index_sequence<L...>) {
+            (read.template operator()<L>(), ...);
+        }(std::make_index_sequence<Depth>{});
+    }
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
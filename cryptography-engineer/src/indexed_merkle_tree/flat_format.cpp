@@ -0,0 +1,119 @@
+#include "flat_format.hpp"
+#include "node_store.hpp"
+#include <bit>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+namespace flat {
+
+static_assert(std::endian::native == std::endian::little, "the flat format is the in-memory layout of the host");
+
+size_t tree_size(size_t depth, size_t num_leaves)
+{
+    size_t num_nodes = 0;
+    for (size_t l = 0; l < depth; l++) {
+        num_nodes += level_size(num_leaves, l);
+    }
+    return TREE_HEADER_SIZE + (depth + num_nodes) * FIELD_SIZE + num_leaves * LEAF_SIZE;
+}
+
+size_t write_leaf(compact_leaf const& value, uint8_t* buffer)
+{
+    write_field(value.value, buffer);
+    write_field(value.nextValue, buffer + FIELD_SIZE);
+    write_u64(value.nextIndex, buffer + 2 * FIELD_SIZE);
+    return LEAF_SIZE;
+}
+
+size_t write_leaf(leaf const& value, uint8_t* buffer)
+{
+    ASSERT(value.nextIndex < (uint256_t(1) << 64));
+    write_field(value.value, buffer);
+    write_field(value.nextValue, buffer + FIELD_SIZE);
+    write_u64(static_cast<uint64_t>(value.nextIndex), buffer + 2 * FIELD_SIZE);
+    return LEAF_SIZE;
+}
+
+size_t write_leaves(std::span<const leaf> leaves, uint8_t* buffer)
+{
+    for (size_t i = 0; i < leaves.size(); i++) {
+        write_leaf(leaves[i], buffer + i * LEAF_SIZE);
+    }
+    return leaves.size() * LEAF_SIZE;
+}
+
+size_t write_hash_path(fr_hash_path const& path, uint8_t* buffer)
+{
+    for (size_t l = 0; l < path.size(); l++) {
+        write_field(path[l].first, buffer + 2 * l * FIELD_SIZE);
+        write_field(path[l].second, buffer + (2 * l + 1) * FIELD_SIZE);
+    }
+    return hash_path_size(path.size());
+}
+
+fr_hash_path hash_path_view::get() const
+{
+    fr_hash_path path(depth_);
+    for (size_t l = 0; l < depth_; l++) {
+        path[l] = (*this)[l];
+    }
+    return path;
+}
+
+tree_view::tree_view(uint8_t const* data, size_t size)
+    : data_(data)
+{
+    if (size < TREE_HEADER_SIZE || read_u64(data) != TREE_MAGIC || read_u64(data + 3 * sizeof(uint64_t)) != 0) {
+        return;
+    }
+    const uint64_t depth = read_u64(data + sizeof(uint64_t));
+    const uint64_t num_leaves = read_u64(data + 2 * sizeof(uint64_t));
+    if (depth == 0 || depth > MAX_TREE_DEPTH || num_leaves == 0 || num_leaves > (uint64_t{ 1 } << depth) ||
+        size != tree_size(depth, num_leaves)) {
+        return;
+    }
+
+    size_t offset = TREE_HEADER_SIZE + depth * FIELD_SIZE;
+    for (size_t l = 0; l < depth; l++) {
+        level_offsets_[l] = offset;
+        offset += level_size(num_leaves, l) * FIELD_SIZE;
+    }
+    leaves_ = data + offset;
+    num_leaves_ = num_leaves;
+    depth_ = depth;
+}
+
+uint8_t const* tree_view::node_data(size_t level, size_t index) const
+{
+    ASSERT(level < depth_ && index < leaf_capacity(depth_ - level));
+    if (index >= level_size(num_leaves_, level)) {
+        return data_ + TREE_HEADER_SIZE + level * FIELD_SIZE;
+    }
+    return data_ + level_offsets_[level] + index * FIELD_SIZE;
+}
+
+fr_hash_path tree_view::get_hash_path(size_t index) const
+{
+    fr_hash_path path(depth_);
+    for (size_t l = 0; l < depth_; l++) {
+        path[l] = std::make_pair(node(l, index & ~1UL), node(l, index | 1UL));
+        index /= 2;
+    }
+    return path;
+}
+
+size_t tree_view::write_hash_path(size_t index, uint8_t* buffer) const
+{
+    for (size_t l = 0; l < depth_; l++) {
+        std::memcpy(buffer + 2 * l * FIELD_SIZE, node_data(l, index & ~1UL), FIELD_SIZE);
+        std::memcpy(buffer + (2 * l + 1) * FIELD_SIZE, node_data(l, index | 1UL), FIELD_SIZE);
+        index /= 2;
+    }
+    return hash_path_size(depth_);
+}
+
+} // namespace flat
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,157 @@
+#pragma once
+#include <stdlib/merkle_tree/hash_path.hpp>
+#include "leaf.hpp"
+#include <array>
+#include <cstring>
+#include <span>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+using namespace barretenberg;
+using namespace plonk::stdlib::merkle_tree;
+
+/**
+ * Fixed-width binary format of leaves, hash paths and whole trees, written into buffers provided by the caller and read
+ * back through views over the buffer, without any allocation or parsing up front.
+ *
+ * Field elements are written as their raw in-memory limbs (Montgomery form, little-endian), like the nodes of a
+ * persistent tree, so that writing and reading them is a plain copy. Integers are little-endian 64-bit words. Records
+ * are not aligned within the buffer, so views read them with memcpy.
+ *
+ *   leaf:      | value | nextValue | nextIndex: u64 |                                                  72 bytes
+ *   hash path: | left_0 | right_0 | left_1 | right_1 | ... |                                    depth * 64 bytes
+ *   tree:      | magic | depth | num_leaves | 0: u64 | root | zero hashes: depth fr | nodes | leaves: num_leaves leaf |
+ *
+ * The nodes of a tree are written level after level, only the first ceil(num_leaves / 2^l) of level l: all the others
+ * are the roots of empty subtrees, whose hash is the zero hash of the level.
+ */
+namespace flat {
+
+constexpr size_t FIELD_SIZE = 32;
+constexpr size_t LEAF_SIZE = 2 * FIELD_SIZE + sizeof(uint64_t);
+constexpr size_t TREE_HEADER_SIZE = 4 * sizeof(uint64_t) + FIELD_SIZE;
+constexpr uint64_t TREE_MAGIC = 0x74616c66746d69ULL; // "imtflat"
+
+constexpr size_t hash_path_size(size_t depth)
+{
+    return depth * 2 * FIELD_SIZE;
+}
+
+// number of nodes written for level `level` of a tree with `num_leaves` leaves
+constexpr size_t level_size(size_t num_leaves, size_t level)
+{
+    return ((num_leaves - 1) >> level) + 1;
+}
+
+size_t tree_size(size_t depth, size_t num_leaves);
+
+inline void write_field(fr const& value, uint8_t* buffer)
+{
+    static_assert(sizeof(value.data) == FIELD_SIZE);
+    std::memcpy(buffer, value.data, FIELD_SIZE);
+}
+
+inline fr read_field(uint8_t const* buffer)
+{
+    fr value;
+    std::memcpy(value.data, buffer, FIELD_SIZE);
+    return value;
+}
+
+inline void write_u64(uint64_t value, uint8_t* buffer)
+{
+    std::memcpy(buffer, &value, sizeof(value));
+}
+
+inline uint64_t read_u64(uint8_t const* buffer)
+{
+    uint64_t value;
+    std::memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+// Each writer returns the number of bytes written at `buffer`, which must have room for them
+size_t write_leaf(compact_leaf const& value, uint8_t* buffer);
+size_t write_leaf(leaf const& value, uint8_t* buffer);
+size_t write_leaves(std::span<const leaf> leaves, uint8_t* buffer);
+size_t write_hash_path(fr_hash_path const& path, uint8_t* buffer);
+
+class leaf_view {
+  public:
+    explicit leaf_view(uint8_t const* data)
+        : data_(data)
+    {}
+
+    fr value() const { return read_field(data_); }
+    fr next_value() const { return read_field(data_ + FIELD_SIZE); }
+    uint64_t next_index() const { return read_u64(data_ + 2 * FIELD_SIZE); }
+
+    leaf get() const { return { value(), next_index(), next_value() }; }
+
+  private:
+    uint8_t const* data_;
+};
+
+class hash_path_view {
+  public:
+    hash_path_view(uint8_t const* data, size_t depth)
+        : data_(data)
+        , depth_(depth)
+    {}
+
+    size_t size() const { return depth_; }
+
+    std::pair<fr, fr> operator[](size_t level) const
+    {
+        return { read_field(data_ + 2 * level * FIELD_SIZE), read_field(data_ + (2 * level + 1) * FIELD_SIZE) };
+    }
+
+    fr_hash_path get() const;
+
+  private:
+    uint8_t const* data_;
+    size_t depth_;
+};
+
+/**
+ * View over a tree written by `IndexedMerkleTree::write_flat`. The buffer is checked once, when the view is built:
+ * reading the nodes, leaves and hash paths of a valid view then touches only the records asked for.
+ */
+class tree_view {
+  public:
+    tree_view(uint8_t const* data, size_t size);
+
+    // false if the buffer does not hold exactly one well-formed tree, in which case nothing else may be called
+    bool is_valid() const { return depth_ != 0; }
+
+    size_t depth() const { return depth_; }
+    size_t num_leaves() const { return num_leaves_; }
+    fr root() const { return read_field(data_ + 4 * sizeof(uint64_t)); }
+
+    fr zero_hash(size_t level) const { return read_field(data_ + TREE_HEADER_SIZE + level * FIELD_SIZE); }
+    fr node(size_t level, size_t index) const { return read_field(node_data(level, index)); }
+    leaf_view leaf_at(size_t index) const { return leaf_view(leaves_ + index * LEAF_SIZE); }
+
+    fr_hash_path get_hash_path(size_t index) const;
+
+    // writes the hash path of the leaf at `index` in the format above, returns the number of bytes written
+    size_t write_hash_path(size_t index, uint8_t* buffer) const;
+
+  private:
+    uint8_t const* node_data(size_t level, size_t index) const;
+
+    uint8_t const* data_;
+    size_t depth_ = 0;
+    size_t num_leaves_ = 0;
+    // offsets of the nodes of every level relative to `data_`, at most 32 levels
+    std::array<size_t, 32> level_offsets_{};
+    uint8_t const* leaves_ = nullptr;
+};
+
+} // namespace flat
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,111 @@
+#include "hash_batch.hpp"
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#ifndef NO_MULTITHREADING
+#include <omp.h>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+namespace {
+
+/**
+ * Pedersen hashes of `n` inputs of `Arity` fields each, `input(i, j)` being field j of input i, as
+ * `compress_native(inputs)` computes them: the x coordinate of Σⱼ inputⱼ·Gⱼ.
+ *
+ * `compress_native` sums the points of a single input in Jacobian coordinates and pays a field inversion to normalise
+ * the sum, and starts a parallel region of `Arity` threads to do it. Here the inputs are split into one contiguous
+ * chunk per thread: a thread sums the points of each of its inputs, then normalises all the sums of its chunk with a
+ * single batch inversion.
+ */
+template <size_t Arity, typename Input> void pedersen_batch(const size_t n, Input const& input, std::span<fr> hashes)
+{
+    if (n == 0) {
+        return;
+    }
+    crypto::generators::init_generator_data();
+    std::vector<grumpkin::g1::element> sums(n);
+
+#ifndef NO_MULTITHREADING
+    const size_t num_threads = n >= PARALLEL_HASH_THRESHOLD ? static_cast<size_t>(omp_get_max_threads()) : 1;
+#else
+    const size_t num_threads = 1;
+#endif
+    const size_t chunk_size = (n + num_threads - 1) / num_threads;
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for num_threads(static_cast<int>(num_threads))
+#endif
+    for (size_t chunk = 0; chunk < num_threads; chunk++) {
+        const size_t start = std::min(n, chunk * chunk_size);
+        const size_t end = std::min(n, start + chunk_size);
+        for (size_t i = start; i < end; i++) {
+            sums[i] = crypto::pedersen::hash_single(input(i, 0), { 0, 0 });
+            for (size_t j = 1; j < Arity; j++) {
+                sums[i] = crypto::pedersen::hash_single(input(i, j), { 0, j }) + sums[i];
+            }
+        }
+        grumpkin::g1::element::batch_normalize(sums.data() + start, end - start);
+        for (size_t i = start; i < end; i++) {
+            hashes[i] = sums[i].is_point_at_infinity() ? fr(0) : sums[i].x;
+        }
+    }
+}
+
+} // namespace
+
+template <typename Hasher> void compress_pairs(std::span<const fr> children, std::span<fr> parents)
+{
+    ASSERT(children.size() == 2 * parents.size());
+    const size_t n = parents.size();
+
+    if constexpr (std::is_same_v<Hasher, pedersen_hasher>) {
+        metrics::add(metrics::COMPRESSIONS, n);
+        pedersen_batch<2>(n, [&](size_t i, size_t j) { return children[2 * i + j]; }, parents);
+    } else {
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for if (n >= PARALLEL_HASH_THRESHOLD)
+#endif
+        for (size_t i = 0; i < n; i++) {
+            parents[i] = compress_pair<Hasher>(children[2 * i], children[2 * i + 1]);
+        }
+    }
+}
+
+template <typename Hasher> void hash_leaves(std::span<const compact_leaf> leaves, std::span<fr> hashes)
+{
+    ASSERT(leaves.size() == hashes.size());
+    const size_t n = leaves.size();
+
+    if constexpr (std::is_same_v<Hasher, pedersen_hasher>) {
+        metrics::add(metrics::COMPRESSIONS, n);
+        pedersen_batch<3>(
+            n,
+            [&](size_t i, size_t j) {
+                compact_leaf const& leaf = leaves[i];
+                return j == 0 ? fr(leaf.value) : j == 1 ? fr(uint256_t(leaf.nextIndex)) : fr(leaf.nextValue);
+            },
+            hashes);
+    } else {
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for if (n >= PARALLEL_HASH_THRESHOLD)
+#endif
+        for (size_t i = 0; i < n; i++) {
+            hashes[i] = leaves[i].template hash<Hasher>();
+        }
+    }
+}
+
+template void compress_pairs<pedersen_hasher>(std::span<const fr>, std::span<fr>);
+template void compress_pairs<blake3s_hasher>(std::span<const fr>, std::span<fr>);
+template void compress_pairs<sha256_hasher>(std::span<const fr>, std::span<fr>);
+template void hash_leaves<pedersen_hasher>(std::span<const compact_leaf>, std::span<fr>);
+template void hash_leaves<blake3s_hasher>(std::span<const compact_leaf>, std::span<fr>);
+template void hash_leaves<sha256_hasher>(std::span<const compact_leaf>, std::span<fr>);
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,29 @@
+#pragma once
+#include "leaf.hpp"
+#include <span>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+using namespace barretenberg;
+
+/**
+ * Batched hashing stage of a tree level: the hashes of a level are independent of each other, so they are gathered
+ * first, computed together across all the cores, and only then written back to the tree. Pedersen hashes of a batch
+ * share the field inversions normalising their points, one per thread, where `compress_native` pays one per hash.
+ *
+ * Batches smaller than `PARALLEL_HASH_THRESHOLD` are hashed on the calling thread, where starting the threads would
+ * cost more than the hashes themselves.
+ */
+constexpr size_t PARALLEL_HASH_THRESHOLD = 16;
+
+// parents[i] = compress_pair(children[2i], children[2i + 1])
+template <typename Hasher = pedersen_hasher> void compress_pairs(std::span<const fr> children, std::span<fr> parents);
+
+template <typename Hasher = pedersen_hasher>
+void hash_leaves(std::span<const compact_leaf> leaves, std::span<fr> hashes);
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
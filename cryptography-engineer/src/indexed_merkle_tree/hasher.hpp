@@ -0,0 +1,71 @@
+#pragma once
+#include <stdlib/primitives/field/field.hpp>
+#include <crypto/blake3s/blake3s.hpp>
+#include <crypto/pedersen/pedersen.hpp>
+#include <crypto/sha256/sha256.hpp>
+#include <vector>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+using namespace barretenberg;
+
+/**
+ * Hashers of a tree, chosen at compile time: the hot loops are instantiated for each of them, so their calls are
+ * inlined. A hasher provides
+ *
+ *   static fr hash_leaf(fr const& value, uint256_t const& next_index, fr const& next_value);
+ *   static fr compress(fr const& lhs, fr const& rhs);
+ *
+ * Pedersen is the hash the circuits check. The byte hashers are cheaper to compute, for trees only used off-chain.
+ */
+struct pedersen_hasher {
+    static fr hash_leaf(fr const& value, uint256_t const& next_index, fr const& next_value)
+    {
+        return crypto::pedersen::compress_native({ value, next_index, next_value });
+    }
+
+    static fr compress(fr const& lhs, fr const& rhs) { return crypto::pedersen::compress_native({ lhs, rhs }); }
+};
+
+/**
+ * Hashes the concatenation of the big-endian encodings of `inputs` with `Hash`, keeping the lowest 253 bits of the
+ * digest so that it is always a canonical field element.
+ */
+template <typename Hash, size_t N> fr hash_fields(std::array<fr, N> const& inputs)
+{
+    std::vector<uint8_t> buffer(N * sizeof(fr));
+    for (size_t i = 0; i < N; i++) {
+        fr::serialize_to_buffer(inputs[i], &buffer[i * sizeof(fr)]);
+    }
+    auto digest = Hash::digest(buffer);
+    digest[0] &= 0x1f;
+    return fr::serialize_from_buffer(&digest[0]);
+}
+
+struct blake3s_hasher {
+    static std::vector<uint8_t> digest(std::vector<uint8_t> const& input) { return blake3::blake3s(input); }
+
+    static fr hash_leaf(fr const& value, uint256_t const& next_index, fr const& next_value)
+    {
+        return hash_fields<blake3s_hasher, 3>({ value, fr(next_index), next_value });
+    }
+
+    static fr compress(fr const& lhs, fr const& rhs) { return hash_fields<blake3s_hasher, 2>({ lhs, rhs }); }
+};
+
+struct sha256_hasher {
+    static sha256::hash digest(std::vector<uint8_t> const& input) { return sha256::sha256(input); }
+
+    static fr hash_leaf(fr const& value, uint256_t const& next_index, fr const& next_value)
+    {
+        return hash_fields<sha256_hasher, 3>({ value, fr(next_index), next_value });
+    }
+
+    static fr compress(fr const& lhs, fr const& rhs) { return hash_fields<sha256_hasher, 2>({ lhs, rhs }); }
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,222 @@
+#include "indexed_merkle_tree.hpp"
+#include "fixed_depth_tree.hpp"
+#include <benchmark/benchmark.h>
+#include <numeric/random/engine.hpp>
+
+using namespace benchmark;
+using namespace plonk::stdlib::indexed_merkle_tree;
+
+namespace {
+auto& engine = numeric::random::get_debug_engine();
+
+// A dense tree of depth d takes 2^(d + 6) bytes, the largest depths need a machine with enough memory
+constexpr size_t MIN_DEPTH = 20;
+#ifndef __wasm__
+constexpr size_t MAX_DEPTH = 28;
+#else
+// a 32-bit WASM memory only holds dense trees up to a depth of 24
+constexpr size_t MAX_DEPTH = 24;
+#endif
+constexpr size_t NUM_LEAVES = 1024;
+
+// Only sparse trees are built up to the maximum depth
+constexpr size_t MIN_CONSTRUCTION_DEPTH = 8;
+constexpr size_t MAX_DENSE_CONSTRUCTION_DEPTH = 24;
+constexpr size_t MAX_CONSTRUCTION_DEPTH = MAX_TREE_DEPTH;
+constexpr size_t BATCH_DEPTH = 24;
+constexpr size_t HASHER_DEPTH = 20;
+
+template <typename Hasher = pedersen_hasher> IndexedMerkleTree<Hasher> filled_tree(size_t depth, storage_mode mode)
+{
+    IndexedMerkleTree<Hasher> tree(depth, mode);
+    std::vector<fr> values(NUM_LEAVES);
+    for (auto& value : values) {
+        value = fr::random_element(&engine);
+    }
+    tree.update_elements(values);
+    return tree;
+}
+
+void construct(State& state, storage_mode mode) noexcept
+{
+    auto depth = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        IndexedMerkleTree tree(depth, mode);
+        DoNotOptimize(tree.root());
+    }
+}
+
+void get_hash_path(State& state, storage_mode mode) noexcept
+{
+    auto depth = static_cast<size_t>(state.range(0));
+    auto tree = filled_tree(depth, mode);
+    for (auto _ : state) {
+        // paths of random leaves across the whole tree, most of them empty
+        auto index = static_cast<size_t>(engine.get_random_uint64()) & (leaf_capacity(depth) - 1);
+        DoNotOptimize(tree.get_hash_path(index));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// `get_hash_path_dense` at a depth fixed at compile time
+template <size_t Depth> void get_hash_path_fixed(State& state) noexcept
+{
+    FixedDepthIndexedMerkleTree<Depth> tree(storage_mode::DENSE);
+    std::vector<fr> values(NUM_LEAVES);
+    for (auto& value : values) {
+        value = fr::random_element(&engine);
+    }
+    tree.update_elements(values);
+    for (auto _ : state) {
+        auto index = static_cast<size_t>(engine.get_random_uint64()) & (leaf_capacity(Depth) - 1);
+        DoNotOptimize(tree.get_hash_path(index));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// non-membership proofs of random values, by a lookup of the low leaf then a read of the leaf and its committed path,
+// or in a single call
+void prove_non_membership(State& state, bool single_call) noexcept
+{
+    auto depth = static_cast<size_t>(state.range(0));
+    auto tree = filled_tree(depth, storage_mode::DENSE);
+    for (auto _ : state) {
+        auto value = fr::random_element(&engine);
+        if (single_call) {
+            DoNotOptimize(tree.prove_non_membership(value));
+        } else {
+            auto index = tree.find_low_leaf(value).first;
+            DoNotOptimize(tree.get_leaf(index));
+            DoNotOptimize(tree.get_committed_hash_path(index));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void update_element(State& state, storage_mode mode) noexcept
+{
+    auto depth = static_cast<size_t>(state.range(0));
+    auto tree = filled_tree(depth, mode);
+    for (auto _ : state) {
+        DoNotOptimize(tree.update_element(fr::random_element(&engine)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void update_elements(State& state) noexcept
+{
+    auto batch_size = static_cast<size_t>(state.range(0));
+    auto tree = filled_tree(BATCH_DEPTH, storage_mode::DENSE);
+    std::vector<fr> values(batch_size);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto& value : values) {
+            value = fr::random_element(&engine);
+        }
+        state.ResumeTiming();
+        DoNotOptimize(tree.update_elements(values));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(batch_size));
+}
+
+// catch-up sync of state.range(0) inserts, replayed from the leaves of a tree that already holds them
+void apply_leaf_updates(State& state) noexcept
+{
+    auto num_inserts = static_cast<size_t>(state.range(0));
+    IndexedMerkleTree source(BATCH_DEPTH);
+    std::vector<fr> values(num_inserts);
+    for (auto& value : values) {
+        value = fr::random_element(&engine);
+    }
+    source.update_elements(values);
+    auto leaves = source.get_leaves();
+    std::vector<leaf_update> updates;
+    for (size_t i = 0; i < leaves.size(); i++) {
+        updates.push_back({ i, leaves[i] });
+    }
+
+    // after the first iteration the updates overwrite identical leaves, which costs the same
+    IndexedMerkleTree tree(BATCH_DEPTH);
+    for (auto _ : state) {
+        DoNotOptimize(tree.apply_leaf_updates(updates));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(num_inserts));
+}
+
+// insert throughput of a hasher, in batches of state.range(0) values
+template <typename Hasher> void insert(State& state) noexcept
+{
+    auto batch_size = static_cast<size_t>(state.range(0));
+    auto tree = filled_tree<Hasher>(HASHER_DEPTH, storage_mode::DENSE);
+    std::vector<fr> values(batch_size);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto& value : values) {
+            value = fr::random_element(&engine);
+        }
+        state.ResumeTiming();
+        DoNotOptimize(tree.update_elements(values));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(batch_size));
+}
+
+void construct_dense(State& state) noexcept
+{
+    construct(state, storage_mode::DENSE);
+}
+
+void construct_sparse(State& state) noexcept
+{
+    construct(state, storage_mode::SPARSE);
+}
+
+void get_hash_path_dense(State& state) noexcept
+{
+    get_hash_path(state, storage_mode::DENSE);
+}
+
+void get_hash_path_blocked(State& state) noexcept
+{
+    get_hash_path(state, storage_mode::BLOCKED);
+}
+
+void find_low_leaf_and_path(State& state) noexcept
+{
+    prove_non_membership(state, false);
+}
+
+void prove_non_membership(State& state) noexcept
+{
+    prove_non_membership(state, true);
+}
+
+void update_element_dense(State& state) noexcept
+{
+    update_element(state, storage_mode::DENSE);
+}
+
+void update_element_blocked(State& state) noexcept
+{
+    update_element(state, storage_mode::BLOCKED);
+}
+} // namespace
+
+BENCHMARK(construct_dense)
+    ->DenseRange(MIN_CONSTRUCTION_DEPTH, MAX_DENSE_CONSTRUCTION_DEPTH, 4)
+    ->Unit(kMillisecond);
+BENCHMARK(construct_sparse)->DenseRange(MIN_CONSTRUCTION_DEPTH, MAX_CONSTRUCTION_DEPTH, 4)->Unit(kMicrosecond);
+BENCHMARK(get_hash_path_dense)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4);
+BENCHMARK(get_hash_path_blocked)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4);
+BENCHMARK_TEMPLATE(get_hash_path_fixed, MIN_DEPTH);
+BENCHMARK_TEMPLATE(get_hash_path_fixed, MIN_DEPTH + 4);
+BENCHMARK(find_low_leaf_and_path)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4);
+BENCHMARK(prove_non_membership)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4);
+BENCHMARK(update_element_dense)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4)->Unit(kMicrosecond);
+BENCHMARK(update_element_blocked)->DenseRange(MIN_DEPTH, MAX_DEPTH, 4)->Unit(kMicrosecond);
+BENCHMARK(update_elements)->RangeMultiplier(4)->Range(16, 1024)->Unit(kMillisecond);
+BENCHMARK(apply_leaf_updates)->RangeMultiplier(8)->Range(64, 1 << 15)->Unit(kMillisecond);
+BENCHMARK_TEMPLATE(insert, pedersen_hasher)->Arg(1)->Arg(64)->Arg(1024)->Unit(kMicrosecond);
+BENCHMARK_TEMPLATE(insert, blake3s_hasher)->Arg(1)->Arg(64)->Arg(1024)->Unit(kMicrosecond);
+BENCHMARK_TEMPLATE(insert, sha256_hasher)->Arg(1)->Arg(64)->Arg(1024)->Unit(kMicrosecond);
+
+BENCHMARK_MAIN();
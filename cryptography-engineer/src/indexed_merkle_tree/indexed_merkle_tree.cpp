@@ -1,122 +1,698 @@
 #include "indexed_merkle_tree.hpp"
-#include <stdlib/merkle_tree/hash.hpp>
+#include "hash_batch.hpp"
+#include <algorithm>
+#include <cstring>
+#ifndef NO_MULTITHREADING
+#include <omp.h>
+#endif
 
 namespace plonk {
 namespace stdlib {
 namespace indexed_merkle_tree {
 
-void IndexedMerkleTree::build_hashes_from_leaves()
+namespace {
+
+/**
+ * Layout of the file of a persistent tree of depth d:
+ *
+ *   | header (one page) | nodes: 2 * 2^d - 2 fr, level after level | leaves: 2^d compact_leaf (72 bytes each) |
+ *
+ * The nodes and leaves are raw in-memory records so that they can be used in place. Every committed batch goes through
+ * the redo journal next to the file (see `redo_journal`): the nodes, leaves and header it writes are journaled before
+ * the file is touched, so the file only ever holds the last committed batch once the journal has been replayed. A
+ * header that is still all zeros belongs to a file whose creation was interrupted.
+ */
+// the low byte is the version of the layout: 2 since leaves are packed
+constexpr uint64_t file_magic = 0x494d5452454502ULL;
+constexpr size_t header_size = 4096;
+
+struct file_header {
+    uint64_t magic;
+    uint64_t depth;
+    uint64_t num_leaves;
+    fr root;
+};
+
+size_t leaves_offset(size_t depth)
+{
+    return header_size + node_store::dense_size(depth) * sizeof(fr);
+}
+
+size_t leaf_offset(size_t depth, size_t index)
 {
-    for (size_t i = total_size_; i < hashes_.size(); i++) {
-        // starting index of level, current node belongs to
-        size_t level_str_idx{};
-        // starting index of level, current nodes children belong to
-        size_t prev_level_str_idx{};
+    return leaves_offset(depth) + index * sizeof(compact_leaf);
+}
+
+size_t file_size(size_t depth)
+{
+    return leaves_offset(depth) + leaf_capacity(depth) * sizeof(compact_leaf);
+}
+
+file_header read_header(mapped_file const& file)
+{
+    file_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    return header;
+}
+
+// Number of subtrees per thread in a bulk rehash, to even out the threads when the dirty leaves are unevenly spread
+constexpr size_t SUBTREES_PER_THREAD = 4;
 
-        for (size_t l = 0; l < level_str_idxs_.size(); l++) {
-            auto lsi = level_str_idxs_[l];
-            if (i >= lsi) {
-                level_str_idx = lsi;
-                if (l > 0)
-                    prev_level_str_idx = level_str_idxs_[l - 1];
+} // namespace
+
+/**
+ * Rehash only the ancestors of the leaves at `indices` (sorted in ascending order, without duplicates), or of the nodes
+ * at `indices` on the level below `first_level`.
+ * The paths are walked up one level at a time, so wherever two paths meet their common ancestor is hashed once, and
+ * the parents of a level are hashed in a single batch.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::rehash_paths(std::vector<size_t> indices, size_t first_level)
+{
+    std::vector<fr> children;
+    std::vector<fr> parents;
+    for (size_t l = first_level; l < depth_; l++) {
+        // parents are written back in place, ascending order is preserved as i / 2 is monotonic
+        size_t num_parents = 0;
+        children.clear();
+        for (size_t i = 0; i < indices.size(); i++) {
+            size_t parent_idx = indices[i] / 2;
+            if (num_parents > 0 && indices[num_parents - 1] == parent_idx) {
+                continue;
             }
+            children.push_back(hashes_.get(l - 1, 2 * parent_idx));
+            children.push_back(hashes_.get(l - 1, 2 * parent_idx + 1));
+            indices[num_parents++] = parent_idx;
+        }
+        indices.resize(num_parents);
+        metrics::add(metrics::NODES_REHASHED, num_parents);
+
+        // writes are kept on this thread, an open checkpoint records them in a map
+        parents.resize(num_parents);
+        compress_pairs<Hasher>(children, parents);
+        for (size_t i = 0; i < num_parents; i++) {
+            hashes_.set(l, indices[i], parents[i]);
+        }
+    }
+
+    calculate_root();
+}
+
+/**
+ * Rehash the ancestors of the leaves at `indices` (sorted in ascending order, without duplicates) for a bulk update.
+ *
+ * The tree is cut into the subtrees rooted at the highest level that still gives every thread several subtrees over
+ * the range of dirty leaves. Subtrees have disjoint nodes, so each is rehashed bottom up by a single thread into a
+ * buffer of its own, without any synchronisation. The buffers are then written to the store on this thread, as an open
+ * checkpoint records writes in a map, and only the few nodes above the subtrees are left to `rehash_paths`.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::rehash_subtrees(std::vector<size_t> const& indices)
+{
+    if (indices.empty()) {
+        calculate_root();
+        return;
+    }
+
+#ifndef NO_MULTITHREADING
+    const auto num_threads = static_cast<size_t>(omp_get_max_threads());
+#else
+    const size_t num_threads = 1;
+#endif
+    const size_t last = indices.back();
+    size_t split = 0;
+    while (split + 1 < depth_ && (last >> (split + 1)) + 1 >= SUBTREES_PER_THREAD * num_threads) {
+        split++;
+    }
+
+    // the dirty leaves of every subtree
+    std::vector<size_t> starts;
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (i == 0 || indices[i] >> split != indices[i - 1] >> split) {
+            starts.push_back(i);
         }
+    }
+    const size_t num_subtrees = starts.size();
+    starts.push_back(indices.size());
+
+    // for every subtree, the (index, value) of its rehashed nodes, level after level from level 1 to `split`
+    using level_nodes = std::vector<std::pair<size_t, fr>>;
+    std::vector<std::vector<level_nodes>> rehashed(num_subtrees, std::vector<level_nodes>(split + 1));
 
-        // calculate children indexes
-        auto in_level_idx = (i - level_str_idx) * 2;
-        auto rch_idx = prev_level_str_idx + in_level_idx;
-        auto lch_idx = rch_idx + 1;
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (size_t s = 0; s < num_subtrees; s++) {
+        auto& levels = rehashed[s];
+        for (size_t i = starts[s]; i < starts[s + 1]; i++) {
+            levels[0].emplace_back(indices[i], hashes_.get(0, indices[i]));
+        }
+        for (size_t l = 1; l <= split; l++) {
+            auto const& children = levels[l - 1];
+            for (size_t k = 0; k < children.size(); k++) {
+                const auto& [index, value] = children[k];
+                fr left;
+                fr right;
+                if (index & 1) {
+                    left = hashes_.get(l - 1, index - 1);
+                    right = value;
+                } else if (k + 1 < children.size() && children[k + 1].first == index + 1) {
+                    left = value;
+                    right = children[++k].second;
+                } else {
+                    left = value;
+                    right = hashes_.get(l - 1, index + 1);
+                }
+                levels[l].emplace_back(index / 2, compress_pair<Hasher>(left, right));
+            }
+            metrics::add(metrics::NODES_REHASHED, levels[l].size());
+        }
+    }
 
-        // update hash if some of the child changed it's hash
-        if (hstats_[rch_idx] == node_status::DIRTY || hstats_[lch_idx] == node_status::DIRTY) {
-            auto rchld = hashes_[rch_idx];
-            auto lchld = hashes_[lch_idx];
-            hashes_[i] = compress_pair(rchld, lchld);
-            // child pair hash, update their statuses
-            hstats_[rch_idx] = node_status::CLEAN;
-            hstats_[lch_idx] = node_status::CLEAN;
-            // node's hash changed, let its parent be aware of it
-            hstats_[i] = node_status::DIRTY;
+    std::vector<size_t> roots;
+    roots.reserve(num_subtrees);
+    for (auto const& levels : rehashed) {
+        for (size_t l = 1; l <= split; l++) {
+            for (auto const& [index, value] : levels[l]) {
+                hashes_.set(l, index, value);
+            }
         }
+        roots.push_back(levels[split][0].first);
     }
+    rehash_paths(std::move(roots), split + 1);
 }
-void IndexedMerkleTree::init_hashes()
+
+/**
+ * Hash the leaves at `indices` in a single batch and store their hashes.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::rehash_leaves(std::vector<size_t> const& indices)
 {
-    auto zleaf_hash = leaf({ 0, 0, 0 }).hash();
-    for (size_t i = 0; i < total_size_; i++) {
-        hashes_[i] = zleaf_hash;
+    std::vector<compact_leaf> leaves(indices.size());
+    std::vector<fr> hashes(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        leaves[i] = leaf_at(indices[i]);
     }
+    hash_leaves<Hasher>(leaves, hashes);
+    for (size_t i = 0; i < indices.size(); i++) {
+        hashes_.set(0, indices[i], hashes[i]);
+    }
+}
 
-    build_hashes_from_leaves();
+/**
+ * Hashes of the subtrees of an empty tree: every level of an empty tree holds a single repeated value, so only `depth`
+ * hashes are needed to describe the initial state of the entire tree.
+ */
+template <typename Hasher>
+std::vector<fr> IndexedMerkleTree<Hasher>::compute_zero_hashes(size_t depth)
+{
+    ASSERT(depth >= 1);
+    std::vector<fr> zero_hashes(depth);
+    zero_hashes[0] = leaf({ 0, 0, 0 }).hash<Hasher>();
+    for (size_t l = 1; l < depth; l++) {
+        zero_hashes[l] = compress_pair<Hasher>(zero_hashes[l - 1], zero_hashes[l - 1]);
+    }
+    return zero_hashes;
 }
 
-void IndexedMerkleTree::calculate_root()
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::calculate_root()
 {
-    size_t hs = hashes_.size();
-    root_ = compress_native(hashes_[hs - 2], hashes_[hs - 1]);
+    root_ = compress_pair<Hasher>(hashes_.get(depth_ - 1, 0), hashes_.get(depth_ - 1, 1));
 }
 
 /**
  * Initialise an indexed merkle tree state with all the leaf values: H({0, 0, 0}).
  * Note that the leaf pre-image vector `leaves_` must be filled with {0, 0, 0} only at index 0.
  */
-IndexedMerkleTree::IndexedMerkleTree(size_t depth)
+template <typename Hasher>
+IndexedMerkleTree<Hasher>::IndexedMerkleTree(size_t depth, storage_mode mode)
     : depth_(depth)
+    , total_size_(leaf_capacity(depth))
+    , leaves_(total_size_)
+    , hashes_(depth, compute_zero_hashes(depth), mode)
 {
-    ASSERT(depth_ >= 1 && depth <= 32);
-    total_size_ = 1UL << depth_;
-    hashes_.resize(total_size_ * 2 - 2);
+    ASSERT(depth_ >= 1 && depth <= MAX_TREE_DEPTH);
+
+    // Build tree
+    leaves_.push_back({ fr(0), fr(0), 0 });
+    leaf_index_ = { { 0, 0 } };
+    calculate_root();
+    published_root_ = root_;
+    published_num_leaves_ = leaves_.size();
+}
 
-    // Exercise: Build the initial state of the entire tree.
-    // Initialize vector of starting indexes for tree levels
-    level_str_idxs_.push_back(0);
-    for (size_t i = 1; i < depth_; i++) {
-        size_t prev = level_str_idxs_[i - 1];
-        level_str_idxs_.push_back(prev + (1 << (depth_ - (i - 1))));
+/**
+ * Open the persistent tree stored in the file at `path`, or create an empty one if the file does not exist.
+ * Both the nodes and the leaves are used straight from the file, nothing is rehashed; only the leaf index is rebuilt.
+ * A batch left in the journal at `path` + ".journal" by an interrupted commit is replayed first.
+ *
+ * Returns nullptr if the file or its journal cannot be opened, or if the file does not hold a tree of the given
+ * `depth`: its root does not match the nodes, or a leaf points past the last one.
+ */
+template <typename Hasher>
+std::unique_ptr<IndexedMerkleTree<Hasher>> IndexedMerkleTree<Hasher>::open(std::string const& path, size_t depth)
+{
+    ASSERT(depth >= 1 && depth <= MAX_TREE_DEPTH);
+
+    mapped_file file(path, file_size(depth));
+    redo_journal journal(path + ".journal");
+    if (!file.is_open() || !journal.is_open()) {
+        return nullptr;
     }
+    journal.replay(file);
 
-    // Inittialize nodes hash statuses
-    hstats_.resize(total_size_ * 2 - 2);
-    hstats_.assign(hstats_.size(), node_status::DIRTY);
+    auto header = read_header(file);
+    const bool fresh = file.created() || header.magic == 0;
+    if (!fresh && (header.magic != file_magic || header.depth != depth || header.num_leaves == 0 ||
+                   header.num_leaves > leaf_capacity(depth))) {
+        return nullptr;
+    }
 
-    // Build tree
-    leaves_ = { { 0, 0, 0 } };
-    init_hashes();
+    std::unique_ptr<IndexedMerkleTree> tree(new IndexedMerkleTree(depth, std::move(file), std::move(journal), fresh));
+    if (fresh) {
+        return tree;
+    }
+    if (tree->root_ != header.root) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < tree->leaves_.size(); i++) {
+        if (tree->leaves_[i].nextIndex >= tree->leaves_.size()) {
+            return nullptr;
+        }
+    }
+    return tree;
+}
+
+/**
+ * A `fresh` file is initialised with an empty tree, synced as a whole before its header is written.
+ */
+template <typename Hasher>
+IndexedMerkleTree<Hasher>::IndexedMerkleTree(size_t depth, mapped_file file, redo_journal journal, bool fresh)
+    : depth_(depth)
+    , total_size_(leaf_capacity(depth))
+    , file_(std::move(file))
+    , journal_(std::move(journal))
+    , leaves_(reinterpret_cast<compact_leaf*>(file_.data() + leaves_offset(depth)),
+              fresh ? 0 : read_header(file_).num_leaves,
+              total_size_)
+    , hashes_(depth, compute_zero_hashes(depth), reinterpret_cast<fr*>(file_.data() + header_size), fresh)
+{
+    if (fresh) {
+        leaves_.push_back({ fr(0), fr(0), 0 });
+    }
+
+    for (size_t i = 0; i < leaves_.size(); i++) {
+        leaf_index_.emplace(uint256_t(fr(leaves_[i].value)), i);
+    }
     calculate_root();
+    published_root_ = root_;
+    published_num_leaves_ = leaves_.size();
+
+    if (fresh) {
+        file_.sync(header_size, file_.size() - header_size);
+        write_header();
+    }
+}
+
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::write_header()
+{
+    file_header header = { file_magic, depth_, leaves_.size(), root_ };
+    std::memcpy(file_.data(), &header, sizeof(header));
+    file_.sync(0, sizeof(header));
+}
+
+/**
+ * Record the nodes, leaves and header written by the open checkpoint of a persistent tree in its journal, and wait for
+ * the journal to be on disk, before `commit` writes them to the file. Returns false, with the journal emptied, if it
+ * could not be written: nothing of the checkpoint may then reach the file.
+ */
+template <typename Hasher>
+bool IndexedMerkleTree<Hasher>::journal_checkpoint()
+{
+    hashes_.for_each_pending([&](size_t position, fr const& value) {
+        journal_.add(header_size + position * sizeof(fr), &value, sizeof(fr));
+    });
+    for (auto const& [index, value] : leaf_overlay_) {
+        journal_.add(leaf_offset(depth_, index), &value, sizeof(value));
+    }
+    // the leaves appended since the checkpoint are contiguous
+    if (leaves_.size() > checkpoint_num_leaves_) {
+        journal_.add(leaf_offset(depth_, checkpoint_num_leaves_),
+                     &leaves_[checkpoint_num_leaves_],
+                     (leaves_.size() - checkpoint_num_leaves_) * sizeof(compact_leaf));
+    }
+    file_header header = { file_magic, depth_, leaves_.size(), root_ };
+    journal_.add(0, &header, sizeof(header));
+    if (!journal_.write()) {
+        journal_.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Sync the pages of the file written by the last commit of a persistent tree, then its header, and clear the journal.
+ * Does nothing for an in-memory tree.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::flush()
+{
+    if (!file_.is_open()) {
+        return;
+    }
+
+    // the header must only reach the disk after the nodes and leaves it describes
+    for (auto const& [offset, length] : journal_.dirty_pages()) {
+        if (offset >= header_size) {
+            file_.sync(offset, length);
+        }
+    }
+    write_header();
+    journal_.clear();
+}
+
+template <typename Hasher>
+std::vector<leaf> IndexedMerkleTree<Hasher>::get_leaves() const
+{
+    std::vector<leaf> leaves;
+    leaves.reserve(leaves_.size());
+    for (size_t i = 0; i < leaves_.size(); i++) {
+        leaves.push_back(leaf_at(i).expand());
+    }
+    return leaves;
+}
+
+/**
+ * Writes the current state of the tree at `buffer`, which must have room for `flat_size()` bytes, in the format of
+ * `flat::tree_view`. Returns the number of bytes written.
+ */
+template <typename Hasher>
+size_t IndexedMerkleTree<Hasher>::write_flat(uint8_t* buffer) const
+{
+    const size_t num_leaves = leaves_.size();
+    flat::write_u64(flat::TREE_MAGIC, buffer);
+    flat::write_u64(depth_, buffer + sizeof(uint64_t));
+    flat::write_u64(num_leaves, buffer + 2 * sizeof(uint64_t));
+    flat::write_u64(0, buffer + 3 * sizeof(uint64_t));
+    flat::write_field(root_, buffer + 4 * sizeof(uint64_t));
+
+    uint8_t* it = buffer + flat::TREE_HEADER_SIZE;
+    for (size_t l = 0; l < depth_; l++) {
+        flat::write_field(hashes_.zero_hash(l), it);
+        it += flat::FIELD_SIZE;
+    }
+    for (size_t l = 0; l < depth_; l++) {
+        const size_t level_size = flat::level_size(num_leaves, l);
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < level_size; i++) {
+            flat::write_field(hashes_.get(l, i), it + i * flat::FIELD_SIZE);
+        }
+        it += level_size * flat::FIELD_SIZE;
+    }
+    for (size_t i = 0; i < num_leaves; i++) {
+        it += flat::write_leaf(leaf_at(i), it);
+    }
+    return static_cast<size_t>(it - buffer);
+}
+
+/**
+ * Rebuild a tree from the state held by `view`. The nodes are copied as they are, nothing is rehashed; only the root
+ * is recomputed from the top nodes and checked against the recorded one.
+ *
+ * Returns nullptr if the view does not describe a consistent tree: a different root or zero hashes, or a leaf pointing
+ * past the end of the tree.
+ */
+template <typename Hasher>
+std::unique_ptr<IndexedMerkleTree<Hasher>> IndexedMerkleTree<Hasher>::from_flat(flat::tree_view const& view,
+                                                                              storage_mode mode)
+{
+    ASSERT(view.is_valid());
+    const size_t depth = view.depth();
+    const size_t num_leaves = view.num_leaves();
+    auto tree = std::make_unique<IndexedMerkleTree>(depth, mode);
+
+    for (size_t l = 0; l < depth; l++) {
+        if (view.zero_hash(l) != tree->hashes_.zero_hash(l)) {
+            return nullptr;
+        }
+    }
+
+    tree->leaf_index_.clear();
+    for (size_t i = 0; i < num_leaves; i++) {
+        auto record = view.leaf_at(i);
+        if (record.next_index() >= num_leaves) {
+            return nullptr;
+        }
+        compact_leaf value = { record.value(), record.next_value(), static_cast<uint32_t>(record.next_index()) };
+        if (i == 0) {
+            tree->leaves_[0] = value;
+        } else {
+            tree->leaves_.push_back(value);
+        }
+        tree->leaf_index_.emplace(uint256_t(fr(value.value)), i);
+    }
+
+    for (size_t l = 0; l < depth; l++) {
+        const size_t level_size = flat::level_size(num_leaves, l);
+        tree->hashes_.extend(l, level_size);
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < level_size; i++) {
+            tree->hashes_.set(l, i, view.node(l, i));
+        }
+    }
+
+    tree->calculate_root();
+    if (tree->root_ != view.root()) {
+        return nullptr;
+    }
+    tree->published_root_ = tree->root_;
+    tree->published_num_leaves_ = tree->leaves_.size();
+    return tree;
 }
 
 /**
  * Fetches a hash-path from a given index in the tree.
  * Note that the size of the fr_hash_path vector should be equal to the depth of the tree.
  */
-fr_hash_path IndexedMerkleTree::get_hash_path(size_t idx)
+template <typename Hasher>
+fr_hash_path IndexedMerkleTree<Hasher>::get_hash_path(size_t idx)
 {
     // Exercise: fill the hash path for a given index.
     fr_hash_path path(depth_);
 
-    // get leaves pair
-    path[0] = idx % 2 ? std::make_pair(hashes_[idx - 1], hashes_[idx]) : std::make_pair(hashes_[idx], hashes_[idx + 1]);
-
-    for (size_t l = 1; l < depth_; l++) {
-        // update index for next level
-        size_t parent_idx = idx / 2;
-        idx = level_str_idxs_[1] + parent_idx;
-        path[l] =
-            idx % 2 ? std::make_pair(hashes_[idx - 1], hashes_[idx]) : std::make_pair(hashes_[idx], hashes_[idx + 1]);
+    for (size_t l = 0; l < depth_; l++) {
+        path[l] = std::make_pair(hashes_.get(l, idx & ~1UL), hashes_.get(l, idx | 1UL));
+        idx /= 2;
     }
 
     return path;
 }
 
+/**
+ * Proof of the leaves at `indices` (in any order, duplicates are ignored), see `hash_multiproof`. This reads the
+ * current state of the tree, like `get_hash_path`.
+ */
+template <typename Hasher>
+hash_multiproof IndexedMerkleTree<Hasher>::get_hash_paths(std::span<const size_t> indices) const
+{
+    hash_multiproof proof;
+    proof.indices.assign(indices.begin(), indices.end());
+    std::sort(proof.indices.begin(), proof.indices.end());
+    proof.indices.erase(std::unique(proof.indices.begin(), proof.indices.end()), proof.indices.end());
+    ASSERT(proof.indices.empty() || proof.indices.back() < total_size_);
+
+    std::vector<size_t> known = proof.indices;
+    for (size_t l = 0; l < depth_; l++) {
+        size_t num_parents = 0;
+        for (size_t i = 0; i < known.size(); i++) {
+            const size_t index = known[i];
+            if (!(index & 1) && i + 1 < known.size() && known[i + 1] == index + 1) {
+                i++;
+            } else {
+                proof.nodes.push_back(hashes_.get(l, index ^ 1));
+            }
+            known[num_parents++] = index / 2;
+        }
+        known.resize(num_parents);
+    }
+
+    return proof;
+}
+
+/**
+ * Fetches the hash-path from a given index in the committed tree, along with its root. Updates are committed at once,
+ * so the path is always consistent with the returned root.
+ *
+ * This can be called from any number of threads while a single other thread updates the tree: readers never block the
+ * writer, they only retry if their read overlapped the commit of an update. Not available for sparse storage.
+ */
+template <typename Hasher>
+std::pair<fr, fr_hash_path> IndexedMerkleTree<Hasher>::get_committed_hash_path(size_t idx) const
+{
+    ASSERT(hashes_.mode() != storage_mode::SPARSE);
+    fr root;
+    fr_hash_path path(depth_);
+
+    uint64_t seq;
+    do {
+        seq = publication_.read_begin();
+        root = published_root_;
+        size_t index = idx;
+        for (size_t l = 0; l < depth_; l++) {
+            path[l] = std::make_pair(hashes_.get_stored(l, index & ~1UL), hashes_.get_stored(l, index | 1UL));
+            index /= 2;
+        }
+    } while (publication_.read_retry(seq));
+
+    return { root, path };
+}
+
+/**
+ * Appends a new leaf with value `value` and splices it into the linked list right after the low leaf at `low_idx`.
+ * Only the leaf pre-images and the leaf index are updated, hashing is left to the caller.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::insert_leaf(size_t low_idx, fr const& value)
+{
+    auto cur_idx = static_cast<uint32_t>(leaves_.size());
+
+    // the new leaf takes over the low leaf's pointer, the low leaf now points to the new leaf
+    compact_leaf low_leaf = leaf_at(low_idx);
+    compact_leaf new_leaf = { value, low_leaf.nextValue, low_leaf.nextIndex };
+    low_leaf.nextValue = value;
+    low_leaf.nextIndex = cur_idx;
+
+    // leaves that predate the open checkpoint are left untouched until it is committed
+    if (hashes_.checkpointed() && low_idx < checkpoint_num_leaves_) {
+        leaf_overlay_[low_idx] = low_leaf;
+    } else {
+        leaves_[low_idx] = low_leaf;
+    }
+    leaves_.push_back(new_leaf);
+    staged_index_.emplace(uint256_t(value), cur_idx);
+    metrics::add(metrics::LEAVES_INSERTED);
+}
+
+/**
+ * Looks up the low leaf of `value` in the sorted leaf index, i.e. the leaf holding the largest value not greater than
+ * `value`. The leaf with value 0 is always present, so a low leaf always exists.
+ * Returns the index of that leaf and whether its value is equal to `value`.
+ *
+ * The values indexed since the checkpoint are looked up in `staged_index_` and take precedence over the committed
+ * ones, which are skipped if they have been overwritten since, so that `leaf_index_` only changes on commit.
+ */
+template <typename Hasher>
+std::pair<size_t, bool> IndexedMerkleTree<Hasher>::find_low_leaf(fr const& value) const
+{
+    metrics::add(metrics::LOW_LEAF_SEARCHES);
+    const uint256_t key(value);
+    auto it = std::prev(leaf_index_.upper_bound(key));
+    while (it != leaf_index_.begin() && removed_values_.count(it->first) != 0) {
+        --it;
+    }
+    auto staged = staged_index_.upper_bound(key);
+    if (staged != staged_index_.begin() && std::prev(staged)->first >= it->first) {
+        it = std::prev(staged);
+    }
+    return { it->second, it->first == key };
+}
+
+/**
+ * Proof that `value` is not in the committed tree, in a single lookup of the low leaf in the sorted leaf index, or
+ * nothing if it is in the tree. The proof holds the root its path leads to.
+ *
+ * Like `get_committed_hash_path`, this can be called from any number of threads while a single other thread updates
+ * the tree, and only retries if it overlapped a commit. The leaf index is only changed by commits, which hold
+ * `commit_lock_` for writing while they publish, so readers wait for that part of a commit to search it. The levels of
+ * a sparse store are reallocated as they grow, so they cannot be read optimistically: a proof in a sparse tree holds
+ * the lock for reading throughout instead.
+ */
+template <typename Hasher>
+std::optional<non_membership_proof> IndexedMerkleTree<Hasher>::prove_non_membership(fr const& value) const
+{
+    metrics::add(metrics::LOW_LEAF_SEARCHES);
+    const uint256_t key(value);
+    non_membership_proof proof{ 0, {}, fr_hash_path(depth_), fr(0) };
+
+    const bool sparse = hashes_.mode() == storage_mode::SPARSE;
+    auto find_low_index = [&] { return std::prev(leaf_index_.upper_bound(key))->second; };
+    auto read = [&] {
+        uint64_t seq;
+        do {
+            seq = publication_.read_begin();
+            proof.root = published_root_;
+            proof.index = sparse ? find_low_index() : commit_lock_.read(find_low_index);
+            if (proof.index >= published_num_leaves_) {
+                continue;
+            }
+            proof.low_leaf = leaves_[proof.index].expand();
+            size_t index = proof.index;
+            for (size_t l = 0; l < depth_; l++) {
+                proof.path[l] = std::make_pair(hashes_.get_stored(l, index & ~1UL), hashes_.get_stored(l, index | 1UL));
+                index /= 2;
+            }
+        } while (publication_.read_retry(seq));
+    };
+    if (sparse) {
+        commit_lock_.read(read);
+    } else {
+        read();
+    }
+
+    if (proof.low_leaf.value == value) {
+        return std::nullopt;
+    }
+    return proof;
+}
+
 /**
  * Update the node values (i.e. `hashes_`) given the leaf hash `value` and its index `index`.
  * Note that indexing in the tree starts from 0.
  * This function should return the updated root of the tree.
+ *
+ * Only the path of the leaf is rehashed. The leaf pre-images and the leaf index are left as they are: this is meant for
+ * replaying trusted state diffs, whose pre-images have been checked elsewhere.
  */
-fr IndexedMerkleTree::update_element_internal(size_t, fr const&)
+template <typename Hasher> fr IndexedMerkleTree<Hasher>::update_element_internal(size_t index, fr const& value)
 {
-    // Exercise: insert the leaf hash `value` at `index`.
-    return 0;
+    return update_elements_internal({ { index, value } });
+}
+
+/**
+ * Write the leaf hashes of `writes`, as pairs of (index, hash), and rehash the paths of all of them at once. Writes are
+ * applied in order, so the last write to an index wins. Returns the new root, which is the old one if the writes could
+ * not be committed (see `commit`).
+ */
+template <typename Hasher>
+fr IndexedMerkleTree<Hasher>::update_elements_internal(std::vector<std::pair<size_t, fr>> const& writes)
+{
+    bool staged = !hashes_.checkpointed();
+    if (staged) {
+        checkpoint();
+    }
+
+    std::vector<size_t> indices;
+    indices.reserve(writes.size());
+    for (auto const& [index, value] : writes) {
+        ASSERT(index < total_size_);
+        hashes_.set(0, index, value);
+        indices.push_back(index);
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    rehash_paths(std::move(indices));
+
+    if (staged && !commit()) {
+        revert();
+    }
+
+    return root_;
 }
 
 /**
@@ -124,8 +700,12 @@ fr IndexedMerkleTree::update_element_internal(size_t, fr const&)
  * You will need to compute `nextIdx, nextVal` according to the way indexed merkle trees work.
  * Further, you will need to update one old leaf pre-image on inserting a new leaf.
  * Lastly, insert the new leaf hash in the tree as well as update the existing leaf hash of the old leaf.
+ *
+ * Returns 0, leaving the tree as it was, if the value is already in the tree, the tree is full, or the insertion could
+ * not be committed (see `commit`).
  */
-fr IndexedMerkleTree::update_element(fr const& val)
+template <typename Hasher>
+fr IndexedMerkleTree<Hasher>::update_element(fr const& val)
 {
     // Exercise: add a new leaf with value `value` to the tree.
     auto cur_idx = leaves_.size();
@@ -133,41 +713,220 @@ fr IndexedMerkleTree::update_element(fr const& val)
     if (cur_idx >= total_size_)
         return 0;
 
-    index_t next_idx;
-    fr next_value;
-    size_t idx = 0;
-    // counter to prevent infinite loop
-    size_t loop_cnt = total_size_;
-
-    while (loop_cnt) {
-        if ((uint64_t)leaves_[idx].nextValue == (uint64_t)val)
-            return 0;
-
-        if ((uint64_t)leaves_[idx].nextValue > (uint64_t)val || leaves_[idx].nextValue == 0) {
-            next_idx = leaves_[idx].nextIndex;
-            next_value = leaves_[idx].nextValue;
-            leaves_[idx].nextValue = val;
-            leaves_[idx].nextIndex = cur_idx;
+    auto [idx, exists] = find_low_leaf(val);
+    if (exists)
+        return 0;
+
+    // stage the update so that it gets published at once, unless a checkpoint is already open
+    bool staged = !hashes_.checkpointed();
+    if (staged) {
+        checkpoint();
+    }
+
+    insert_leaf(idx, val);
+
+    // only the paths of the new leaf and the updated low leaf have changed
+    rehash_leaves({ idx, cur_idx });
+    rehash_paths({ idx, cur_idx });
+
+    if (staged && !commit()) {
+        revert();
+        return 0;
+    }
+
+    return root_;
+}
+
+/**
+ * Insert a batch of `values`, with the same end result as calling `update_element` on each of them in order.
+ * The linked list is spliced for the whole batch first, then every touched leaf is hashed once and every affected
+ * node is recomputed once, level by level.
+ *
+ * Returns the new root and, for every processed value, the low leaf it was inserted after (its index and pre-image
+ * just before that insertion). A value that is already present gets the leaf holding it as its witness and is skipped.
+ * If the tree fills up, the remaining values are not processed and get no witness. If the batch could not be
+ * committed (see `commit`), the tree is left as it was and no value gets a witness.
+ */
+template <typename Hasher>
+batch_update_result IndexedMerkleTree<Hasher>::update_elements(std::vector<fr> const& values)
+{
+    batch_update_result result;
+    result.low_leaves.reserve(values.size());
+
+    std::vector<size_t> touched;
+    touched.reserve(2 * values.size());
+
+    bool staged = !hashes_.checkpointed();
+    if (staged) {
+        checkpoint();
+    }
+
+    for (auto const& val : values) {
+        auto cur_idx = leaves_.size();
+        if (cur_idx >= total_size_)
             break;
+
+        auto [idx, exists] = find_low_leaf(val);
+        result.low_leaves.push_back({ idx, leaf_at(idx).expand() });
+        if (exists)
+            continue;
+
+        insert_leaf(idx, val);
+        touched.push_back(idx);
+        touched.push_back(cur_idx);
+    }
+
+    // a low leaf may be touched several times in one batch, hash it only once
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    rehash_leaves(touched);
+
+    rehash_paths(std::move(touched));
+
+    if (staged && !commit()) {
+        revert();
+        result.low_leaves.clear();
+    }
+
+    result.root = root_;
+    return result;
+}
+
+/**
+ * Catch-up sync: apply `updates`, leaf pre-images already known to be valid such as the state diffs replayed by a node
+ * that fell behind, in order. An update either overwrites an existing leaf or appends the next one.
+ *
+ * The leaves are all written first, then every touched leaf is hashed once and the dirty nodes are rebuilt once, split
+ * by subtree across the cores (see `rehash_subtrees`). The whole batch is staged in a checkpoint and committed at once,
+ * like `update_elements`, so concurrent readers only wait for the commit. Cannot be called while a checkpoint is open,
+ * as a checkpoint cannot revert overwritten leaves. Returns the new root, which is the old one if the batch could not
+ * be committed (see `commit`).
+ */
+template <typename Hasher> fr IndexedMerkleTree<Hasher>::apply_leaf_updates(std::vector<leaf_update> const& updates)
+{
+    ASSERT(!hashes_.checkpointed());
+    checkpoint();
+
+    std::vector<size_t> dirty;
+    dirty.reserve(updates.size());
+    for (auto const& [index, pre_image] : updates) {
+        ASSERT(index <= leaves_.size() && index < total_size_ && pre_image.nextIndex < total_size_);
+        compact_leaf value = { pre_image.value, pre_image.nextValue, static_cast<uint32_t>(pre_image.nextIndex) };
+        if (index == leaves_.size()) {
+            leaves_.push_back(value);
+            metrics::add(metrics::LEAVES_INSERTED);
+        } else {
+            unindex_leaf(index);
+            if (index < checkpoint_num_leaves_) {
+                leaf_overlay_[index] = value;
+            } else {
+                leaves_[index] = value;
+            }
         }
+        // a value replayed at another index moves there
+        staged_index_.insert_or_assign(uint256_t(fr(value.value)), index);
+        dirty.push_back(index);
+    }
+
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    rehash_leaves(dirty);
+    rehash_subtrees(dirty);
 
-        idx = static_cast<size_t>(leaves_[idx].nextIndex);
-        loop_cnt--;
+    if (!commit()) {
+        revert();
     }
+    return root_;
+}
+
+/**
+ * Drop the current value of the leaf at `index` from the leaf index, before the leaf is overwritten. A committed value
+ * is only recorded as removed, `leaf_index_` is left as it is until the commit.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::unindex_leaf(size_t index)
+{
+    const uint256_t key(fr(leaf_at(index).value));
+    auto staged = staged_index_.find(key);
+    if (staged != staged_index_.end() && staged->second == index) {
+        staged_index_.erase(staged);
+        return;
+    }
+    auto committed = leaf_index_.find(key);
+    if (committed != leaf_index_.end() && committed->second == index) {
+        removed_values_.insert(key);
+    }
+}
+
+/**
+ * Take a checkpoint of the tree. From now on, updates only record the nodes and leaves they touch on the side, until
+ * they are either committed or reverted. Checkpoints do not nest.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::checkpoint()
+{
+    ASSERT(!hashes_.checkpointed());
+    hashes_.checkpoint();
+    checkpoint_root_ = root_;
+    checkpoint_num_leaves_ = leaves_.size();
+}
 
-    leaves_.push_back(leaf({ val, next_idx, next_value }));
+/**
+ * Keep all the updates made since the checkpoint. The cost is proportional to the number of nodes they touched.
+ *
+ * Returns false if the updates of a persistent tree could not be recorded in its journal. The file is then left as it
+ * was and the checkpoint stays open, to be committed again or reverted.
+ */
+template <typename Hasher>
+bool IndexedMerkleTree<Hasher>::commit()
+{
+    if (file_.is_open() && !journal_checkpoint()) {
+        return false;
+    }
 
-    hashes_[cur_idx] = leaves_[cur_idx].hash();
-    hashes_[idx] = leaves_[idx].hash();
-    hstats_[idx] = node_status::DIRTY;
-    hstats_[cur_idx] = node_status::DIRTY;
+    // concurrent readers only look at committed nodes, this is the only time they can see them change
+    commit_lock_.write([&] {
+        publication_.write_begin();
+        hashes_.commit();
+        for (auto const& [index, leaf] : leaf_overlay_) {
+            leaves_[index] = leaf;
+        }
+        for (auto const& key : removed_values_) {
+            leaf_index_.erase(key);
+        }
+        for (auto const& [key, index] : staged_index_) {
+            leaf_index_.insert_or_assign(key, index);
+        }
+        published_root_ = root_;
+        published_num_leaves_ = leaves_.size();
+        publication_.write_end();
+    });
 
-    build_hashes_from_leaves();
-    calculate_root();
+    leaf_overlay_.clear();
+    staged_index_.clear();
+    removed_values_.clear();
+    flush();
+    return true;
+}
 
-    return 0;
+/**
+ * Roll the tree back to its state at the checkpoint. The cost is proportional to the number of nodes touched since.
+ */
+template <typename Hasher>
+void IndexedMerkleTree<Hasher>::revert()
+{
+    hashes_.revert();
+    leaf_overlay_.clear();
+    leaves_.truncate(checkpoint_num_leaves_);
+    staged_index_.clear();
+    removed_values_.clear();
+    root_ = checkpoint_root_;
 }
 
+template class IndexedMerkleTree<pedersen_hasher>;
+template class IndexedMerkleTree<blake3s_hasher>;
+template class IndexedMerkleTree<sha256_hasher>;
+
 } // namespace indexed_merkle_tree
 } // namespace stdlib
 } // namespace plonk
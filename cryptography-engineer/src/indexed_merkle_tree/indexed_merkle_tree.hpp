@@ -1,6 +1,20 @@
 #pragma once
 #include <stdlib/merkle_tree/hash_path.hpp>
+#include "arena.hpp"
+#include "flat_format.hpp"
+#include "journal.hpp"
 #include "leaf.hpp"
+#include "mapped_file.hpp"
+#include "multiproof.hpp"
+#include "node_store.hpp"
+#include "seqlock.hpp"
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <unordered_map>
 
 namespace plonk {
 namespace stdlib {
@@ -9,6 +23,57 @@ namespace indexed_merkle_tree {
 using namespace barretenberg;
 using namespace plonk::stdlib::merkle_tree;
 
+/**
+ * Low leaf of a single insertion: its index and its pre-image just before the new value was spliced in after it.
+ */
+struct low_leaf_witness {
+    size_t index;
+    leaf pre_image;
+
+    bool operator==(low_leaf_witness const&) const = default;
+};
+
+/**
+ * Pre-image to write at `index` by a catch-up sync, serialized as the index followed by the leaf.
+ */
+struct leaf_update {
+    size_t index;
+    leaf pre_image;
+
+    bool operator==(leaf_update const&) const = default;
+
+    void read(uint8_t const*& it)
+    {
+        uint64_t value;
+        serialize::read(it, value);
+        index = value;
+        pre_image.read(it);
+    }
+
+    inline void write(std::vector<uint8_t>& buf)
+    {
+        serialize::write(buf, static_cast<uint64_t>(index));
+        pre_image.write(buf);
+    }
+};
+
+/**
+ * Proof that a value is not in a tree: its low leaf, whose range (value, nextValue) strictly covers it, or whose
+ * nextValue is 0 if the value is above all the others, along with the index and the hash path of that leaf, and the
+ * root of the tree the path leads to.
+ */
+struct non_membership_proof {
+    size_t index;
+    leaf low_leaf;
+    fr_hash_path path;
+    fr root;
+};
+
+struct batch_update_result {
+    fr root;
+    std::vector<low_leaf_witness> low_leaves;
+};
+
 /**
  * An IndexedMerkleTree is structured just like a usual merkle tree:
  *
@@ -66,27 +131,85 @@ using namespace plonk::stdlib::merkle_tree;
  *  val       0       30      10      20       50      0       0       0
  *  nextIdx   2       4       3       1        0       0       0       0
  *  nextVal   10      50      20      30       0       0       0       0
+ *
+ * Leaves and nodes are hashed by `Hasher` (see hasher.hpp). Trees are instantiated for the hashers of hasher.hpp.
  */
-class IndexedMerkleTree {
+template <typename Hasher = pedersen_hasher> class IndexedMerkleTree {
   public:
-    IndexedMerkleTree(size_t depth);
+    IndexedMerkleTree(size_t depth)
+        : IndexedMerkleTree(depth, default_storage_mode(depth))
+    {}
+    IndexedMerkleTree(size_t depth, storage_mode mode);
+
+    static std::unique_ptr<IndexedMerkleTree> open(std::string const& path, size_t depth);
+
+    static std::unique_ptr<IndexedMerkleTree> from_flat(flat::tree_view const& view,
+                                                        storage_mode mode = storage_mode::DENSE);
+
+    size_t flat_size() const { return flat::tree_size(depth_, leaves_.size()); }
+    size_t write_flat(uint8_t* buffer) const;
 
     fr_hash_path get_hash_path(size_t index);
 
+    std::pair<fr, fr_hash_path> get_committed_hash_path(size_t index) const;
+
+    hash_multiproof get_hash_paths(std::span<const size_t> indices) const;
+
     fr update_element_internal(size_t index, fr const& value);
 
+    fr update_elements_internal(std::vector<std::pair<size_t, fr>> const& writes);
+
+    fr apply_leaf_updates(std::vector<leaf_update> const& updates);
+
     fr update_element(fr const& value);
 
+    batch_update_result update_elements(std::vector<fr> const& values);
+
+    std::pair<size_t, bool> find_low_leaf(fr const& value) const;
+
+    std::optional<non_membership_proof> prove_non_membership(fr const& value) const;
+
     fr root() const { return root_; }
 
-    const std::vector<barretenberg::fr>& get_hashes() { return hashes_; }
-    const std::vector<leaf>& get_leaves() { return leaves_; }
+    void checkpoint();
+    bool commit();
+    void revert();
+
+    std::vector<barretenberg::fr> get_hashes() const { return hashes_.get_hashes(); }
+    std::vector<leaf> get_leaves() const;
+    leaf get_leaf(size_t index) const { return leaf_at(index).expand(); }
+    size_t num_leaves() const { return leaves_.size(); }
+
+  protected:
+    // the nodes as read by `get_hash_path`, for the specialised reads of `FixedDepthIndexedMerkleTree`
+    fr get_node(size_t level, size_t index) const { return hashes_.get(level, index); }
+    fr const* dense_nodes() const { return hashes_.dense_nodes(); }
 
   private:
+    IndexedMerkleTree(size_t depth, mapped_file file, redo_journal journal, bool fresh);
+
     // helper functions
-    void init_hashes();
+    static std::vector<fr> compute_zero_hashes(size_t depth);
     void calculate_root();
-    void build_hashes_from_leaves();
+    void rehash_paths(std::vector<size_t> indices, size_t first_level = 1);
+    void rehash_subtrees(std::vector<size_t> const& indices);
+    void rehash_leaves(std::vector<size_t> const& indices);
+    void insert_leaf(size_t low_idx, fr const& value);
+    void unindex_leaf(size_t index);
+    bool journal_checkpoint();
+    void flush();
+    void write_header();
+
+    compact_leaf const& leaf_at(size_t index) const
+    {
+        if (hashes_.checkpointed()) {
+            auto it = leaf_overlay_.find(index);
+            if (it != leaf_overlay_.end()) {
+                return it->second;
+            }
+        }
+        return leaves_[index];
+    }
 
   private:
     // The depth or height of the tree
@@ -98,23 +221,41 @@ class IndexedMerkleTree {
     // The root of the merkle tree
     barretenberg::fr root_;
 
-    // Vector of pre-images of leaf values of the form {val, nextIdx, nextIdx}
-    // Size = total_size_
-    std::vector<leaf> leaves_;
+    // The file holding `hashes_` and `leaves_` of a persistent tree, not open otherwise
+    mapped_file file_;
+
+    // The journal of the batches committed to `file_`, not open for an in-memory tree
+    redo_journal journal_;
+
+    // Compact pre-images of leaf values of the form {val, nextVal, nextIdx}
+    // Capacity = total_size_, reserved up front so that inserting never reallocates
+    arena<compact_leaf> leaves_;
+
+    // Stores all the leaf hashes as well as intermediate node values
+    // Size: total_size_ + (total_size_ / 2) + (total_size_ / 4) + ... + 2 = 2 * total_size_ - 2 when dense
+    node_store hashes_;
+
+    // Sorted index from the values of the committed leaves to their indexes, used for low leaf lookups
+    std::map<uint256_t, size_t> leaf_index_;
 
-    // Vector that stores all the leaf hashes as well as intermediate node values
-    // Size: total_size_ + (total_size_ / 2) + (total_size_ / 4) + ... + 2 = 2 * total_size_ - 2
-    std::vector<barretenberg::fr> hashes_;
+    // The root and number of leaves of the committed tree, and the lock publishing committed nodes to concurrent
+    // readers
+    barretenberg::fr published_root_;
+    size_t published_num_leaves_ = 0;
+    seqlock publication_;
 
-    // Vector of starting indexes for tree levels
-    std::vector<size_t> level_str_idxs_;
+    // Held for writing by commits while they publish, and for reading by the concurrent readers of what `publication_`
+    // cannot cover: the leaf index and the levels of a sparse store
+    rw_lock commit_lock_;
 
-    // Hash statuses for performance optimizations
-    enum class node_status : uint8_t {
-        DIRTY = 0, // hash of this node outdated because of the change in leaf
-        CLEAN = 1, // hash of this node is actual no need to rehash
-    };
-    std::vector<node_status> hstats_;
+    // State of the open checkpoint: the root and number of leaves when it was taken, the leaves that existed then and
+    // have been updated since, the values indexed since and the committed values no longer in the tree. Node updates
+    // are recorded by `hashes_`.
+    fr checkpoint_root_;
+    size_t checkpoint_num_leaves_ = 0;
+    std::unordered_map<size_t, compact_leaf> leaf_overlay_;
+    std::map<uint256_t, size_t> staged_index_;
+    std::set<uint256_t> removed_values_;
 };
 
 } // namespace indexed_merkle_tree
@@ -1,6 +1,14 @@
 #include "indexed_merkle_tree.hpp"
+#include "fixed_depth_tree.hpp"
+#include "hash_batch.hpp"
+#include "update_scheduler.hpp"
 #include <gtest/gtest.h>
 #include <stdlib/types/turbo.hpp>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
 
 using namespace barretenberg;
 using namespace plonk::stdlib::indexed_merkle_tree;
@@ -19,15 +27,16 @@ void print_tree(const size_t depth, std::vector<fr> hashes, std::string const& m
     }
 }
 
+template <typename Hasher = pedersen_hasher>
 bool check_hash_path(const fr& root, const fr_hash_path& path, const leaf& leaf_value, const size_t idx)
 {
-    auto current = leaf_value.hash();
+    auto current = leaf_value.hash<Hasher>();
     size_t depth_ = path.size();
     size_t index = idx;
     for (size_t i = 0; i < depth_; ++i) {
         fr left = (index & 1) ? path[i].first : current;
         fr right = (index & 1) ? current : path[i].second;
-        current = compress_pair(left, right);
+        current = compress_pair<Hasher>(left, right);
         index >>= 1;
     }
     return current == root;
@@ -178,27 +187,996 @@ TEST(stdlib_indexed_merkle_tree, test_real_example)
         tree.update_element(value);
     }
 
-    auto abs_diff = [](uint256_t a, uint256_t b) {
-        if (a > b) {
-            return (a - b);
-        } else {
-            return (b - a);
-        }
-    };
-
     // Check if a new random value is not a member of this tree.
     fr new_member = fr::random_element();
+    auto proof = tree.prove_non_membership(new_member);
+    ASSERT_TRUE(proof.has_value());
+    EXPECT_LT(uint256_t(proof->low_leaf.value), uint256_t(new_member));
+    EXPECT_TRUE(proof->low_leaf.nextValue == 0 || uint256_t(new_member) < uint256_t(proof->low_leaf.nextValue));
+
+    // Merkle proof of the low leaf proves non-membership of `new_member`
+    EXPECT_TRUE(check_hash_path(tree.root(), proof->path, proof->low_leaf, proof->index));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_path_rehash_matches_full_rebuild)
+{
+    constexpr size_t depth = 6;
+    IndexedMerkleTree tree(depth);
+
+    for (size_t i = 0; i < 40; i++) {
+        tree.update_element(fr::random_element());
+    }
+
+    // Recompute every node from the leaf pre-images and compare against the incrementally updated tree
+    const auto& leaves = tree.get_leaves();
+    std::vector<fr> expected;
+    for (size_t i = 0; i < (1UL << depth); i++) {
+        expected.push_back(i < leaves.size() ? leaves[i].hash() : leaf({ 0, 0, 0 }).hash());
+    }
+    size_t offset = 0;
+    for (size_t l = 1; l < depth; l++) {
+        size_t layer_size = (1UL << (depth - l));
+        for (size_t j = 0; j < layer_size; j++) {
+            expected.push_back(compress_pair(expected[offset + 2 * j], expected[offset + 2 * j + 1]));
+        }
+        offset += 2 * layer_size;
+    }
+
+    EXPECT_EQ(tree.get_hashes(), expected);
+    EXPECT_EQ(tree.root(), compress_pair(expected[expected.size() - 2], expected[expected.size() - 1]));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_low_leaf_index)
+{
+    constexpr size_t depth = 6;
+    IndexedMerkleTree tree(depth);
+
+    std::vector<fr> values;
+    for (size_t i = 0; i < 30; i++) {
+        values.push_back(fr::random_element());
+        tree.update_element(values.back());
+    }
+
+    // Inserting an existing value must be rejected
+    auto root = tree.root();
+    EXPECT_EQ(tree.update_element(values[7]), fr(0));
+    EXPECT_EQ(tree.get_leaves().size(), 31);
+    EXPECT_EQ(tree.root(), root);
+
+    // Every inserted value is found at its own leaf
+    for (size_t i = 0; i < values.size(); i++) {
+        auto [index, exists] = tree.find_low_leaf(values[i]);
+        EXPECT_TRUE(exists);
+        EXPECT_EQ(index, i + 1);
+    }
+
+    // Walking the linked list from leaf 0 visits every leaf in strictly increasing order
+    const auto& leaves = tree.get_leaves();
+    size_t idx = 0;
+    for (size_t i = 1; i < leaves.size(); i++) {
+        size_t next_idx = static_cast<size_t>(leaves[idx].nextIndex);
+        EXPECT_EQ(leaves[next_idx].value, leaves[idx].nextValue);
+        EXPECT_LT(uint256_t(leaves[idx].value), uint256_t(leaves[next_idx].value));
+        idx = next_idx;
+    }
+    EXPECT_EQ(leaves[idx].nextValue, fr(0));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_batch_insertion)
+{
+    constexpr size_t depth = 6;
+    IndexedMerkleTree sequential_tree(depth);
+    IndexedMerkleTree batch_tree(depth);
+
+    std::vector<fr> values;
+    for (size_t i = 0; i < 25; i++) {
+        values.push_back(fr::random_element());
+    }
+    // duplicates, both within the batch and of an existing leaf, are skipped
+    values.push_back(values[3]);
+    values.push_back(0);
+    values.push_back(fr::random_element());
+
+    std::vector<low_leaf_witness> expected;
+    for (auto const& value : values) {
+        auto index = sequential_tree.find_low_leaf(value).first;
+        expected.push_back({ index, sequential_tree.get_leaves()[index] });
+        sequential_tree.update_element(value);
+    }
+
+    auto result = batch_tree.update_elements(values);
+
+    EXPECT_EQ(result.root, sequential_tree.root());
+    EXPECT_EQ(batch_tree.root(), sequential_tree.root());
+    EXPECT_EQ(batch_tree.get_hashes(), sequential_tree.get_hashes());
+    EXPECT_EQ(batch_tree.get_leaves(), sequential_tree.get_leaves());
+    EXPECT_EQ(result.low_leaves, expected);
+}
+
+TEST(stdlib_indexed_merkle_tree, test_sparse_storage)
+{
+    constexpr size_t depth = 7;
+    IndexedMerkleTree dense_tree(depth);
+    IndexedMerkleTree sparse_tree(depth, storage_mode::SPARSE);
+    EXPECT_EQ(sparse_tree.root(), dense_tree.root());
+
+    std::vector<fr> values;
+    for (size_t i = 0; i < 20; i++) {
+        values.push_back(fr::random_element());
+        dense_tree.update_element(values.back());
+    }
+    sparse_tree.update_elements(values);
+
+    EXPECT_EQ(sparse_tree.root(), dense_tree.root());
+    EXPECT_EQ(sparse_tree.get_hashes(), dense_tree.get_hashes());
+    for (size_t i = 0; i < (1UL << depth); i += 9) {
+        EXPECT_EQ(sparse_tree.get_hash_path(i), dense_tree.get_hash_path(i));
+    }
+}
+
+TEST(stdlib_indexed_merkle_tree, test_blocked_storage)
+{
+    // Depths with a partial top band of every possible height
+    for (size_t depth : { 4UL, 5UL, 6UL, 7UL, 9UL }) {
+        IndexedMerkleTree dense(depth);
+        IndexedMerkleTree blocked(depth, storage_mode::BLOCKED);
+        EXPECT_EQ(blocked.root(), dense.root());
+
+        for (size_t i = 0; i < 12; i++) {
+            auto value = fr::random_element();
+            EXPECT_EQ(blocked.update_element(value), dense.update_element(value));
+        }
+        EXPECT_EQ(blocked.get_hashes(), dense.get_hashes());
+        for (size_t i = 0; i < (1UL << depth); i += 3) {
+            EXPECT_EQ(blocked.get_hash_path(i), dense.get_hash_path(i));
+        }
+    }
+}
+
+TEST(stdlib_indexed_merkle_tree, test_sparse_storage_max_depth)
+{
+    // A dense depth-32 tree would need 2^33 nodes
+    constexpr size_t depth = MAX_TREE_DEPTH;
+    IndexedMerkleTree tree(depth, storage_mode::SPARSE);
+
+    for (size_t i = 0; i < 10; i++) {
+        tree.update_element(fr::random_element());
+    }
+
     const auto& leaves = tree.get_leaves();
-    std::vector<uint256_t> differences;
     for (size_t i = 0; i < leaves.size(); i++) {
-        uint256_t diff_hi = abs_diff(uint256_t(new_member), uint256_t(leaves[i].value));
-        uint256_t diff_lo = abs_diff(uint256_t(new_member), uint256_t(leaves[i].nextValue));
-        differences.push_back(diff_hi + diff_lo);
+        EXPECT_TRUE(check_hash_path(tree.root(), tree.get_hash_path(i), leaves[i], i));
+    }
+    size_t empty_idx = leaf_capacity(depth) - 1;
+    EXPECT_TRUE(check_hash_path(tree.root(), tree.get_hash_path(empty_idx), leaf({ 0, 0, 0 }), empty_idx));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_sparse_store_far_writes)
+{
+    constexpr size_t depth = MAX_TREE_DEPTH;
+    std::vector<fr> zero_hashes(depth);
+    for (size_t l = 0; l < depth; l++) {
+        zero_hashes[l] = fr(l);
+    }
+    node_store store(depth, zero_hashes, storage_mode::SPARSE);
+
+    // A write far past the stored prefix does not allocate the nodes before it
+    const size_t far = leaf_capacity(depth) - 1;
+    store.set(0, far, fr(7));
+    EXPECT_EQ(store.stored_size(0), 0UL);
+    EXPECT_EQ(store.get(0, far), fr(7));
+    EXPECT_EQ(store.get(0, far - 1), zero_hashes[0]);
+
+    // Nodes written out of order join the prefix once the gap before them is filled
+    store.set(1, 2, fr(12));
+    store.set(1, 1, fr(11));
+    EXPECT_EQ(store.stored_size(1), 0UL);
+    store.set(1, 0, fr(10));
+    EXPECT_EQ(store.stored_size(1), 3UL);
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(store.get(1, i), fr(10 + i));
     }
-    auto it = std::min_element(differences.begin(), differences.end());
-    auto index = static_cast<size_t>(it - differences.begin());
 
-    // Merkle proof at `index` proves non-membership of `new_member`
-    auto hash_path = tree.get_hash_path(index);
-    EXPECT_TRUE(check_hash_path(tree.root(), hash_path, leaves[index], index));
-}
\ No newline at end of file
+    // as does a written node inside an extended prefix
+    store.set(2, 5, fr(25));
+    store.extend(2, 8);
+    EXPECT_EQ(store.stored_size(2), 8UL);
+    EXPECT_EQ(store.get(2, 5), fr(25));
+    EXPECT_EQ(store.get(2, 4), zero_hashes[2]);
+}
+
+TEST(stdlib_indexed_merkle_tree, test_copy_is_independent)
+{
+    constexpr size_t depth = 5;
+    IndexedMerkleTree tree(depth);
+    for (size_t i = 0; i < 10; i++) {
+        tree.update_element(fr::random_element());
+    }
+
+    IndexedMerkleTree copy = tree;
+    EXPECT_EQ(copy.get_leaves(), tree.get_leaves());
+    EXPECT_EQ(copy.root(), tree.root());
+
+    auto leaves = tree.get_leaves();
+    auto root = tree.root();
+    copy.update_element(fr::random_element());
+    EXPECT_EQ(copy.num_leaves(), 12);
+    EXPECT_EQ(tree.get_leaves(), leaves);
+    EXPECT_EQ(tree.root(), root);
+    EXPECT_NE(copy.root(), root);
+}
+
+TEST(stdlib_indexed_merkle_tree, test_checkpoint_revert_and_commit)
+{
+    constexpr size_t depth = 6;
+    for (auto mode : { storage_mode::DENSE, storage_mode::BLOCKED, storage_mode::SPARSE }) {
+        IndexedMerkleTree tree(depth, mode);
+        IndexedMerkleTree expected(depth, mode);
+        std::vector<fr> values;
+        for (size_t i = 0; i < 10; i++) {
+            values.push_back(fr::random_element());
+        }
+        tree.update_elements(values);
+        expected.update_elements(values);
+
+        // Reverting discards every update made since the checkpoint, which are seen until then
+        tree.checkpoint();
+        auto ahead = expected;
+        for (size_t i = 0; i < 10; i++) {
+            auto value = fr::random_element();
+            tree.update_element(value);
+            ahead.update_element(value);
+        }
+        EXPECT_NE(tree.root(), expected.root());
+        EXPECT_EQ(tree.get_leaves(), ahead.get_leaves());
+        EXPECT_EQ(tree.get_hashes(), ahead.get_hashes());
+        tree.revert();
+        EXPECT_EQ(tree.root(), expected.root());
+        EXPECT_EQ(tree.get_leaves(), expected.get_leaves());
+        EXPECT_EQ(tree.get_hashes(), expected.get_hashes());
+
+        // Committing keeps them
+        values.clear();
+        for (size_t i = 0; i < 10; i++) {
+            values.push_back(fr::random_element());
+        }
+        tree.checkpoint();
+        tree.update_elements(values);
+        EXPECT_EQ(tree.find_low_leaf(values[0]), std::make_pair(size_t(11), true));
+        expected.update_elements(values);
+        EXPECT_EQ(tree.get_hashes(), expected.get_hashes());
+        EXPECT_TRUE(tree.commit());
+        EXPECT_EQ(tree.root(), expected.root());
+        EXPECT_EQ(tree.get_leaves(), expected.get_leaves());
+        EXPECT_EQ(tree.get_hashes(), expected.get_hashes());
+    }
+}
+
+#ifndef __wasm__
+TEST(stdlib_indexed_merkle_tree, test_persistent_tree)
+{
+    constexpr size_t depth = 6;
+    std::string path = "indexed_merkle_tree_test.db";
+    std::remove(path.c_str());
+
+    IndexedMerkleTree expected(depth);
+    {
+        auto tree = IndexedMerkleTree<>::open(path, depth);
+        ASSERT_NE(tree, nullptr);
+        EXPECT_EQ(tree->root(), expected.root());
+
+        std::vector<fr> values;
+        for (size_t i = 0; i < 20; i++) {
+            values.push_back(fr::random_element());
+        }
+        tree->update_elements(values);
+        expected.update_elements(values);
+        auto value = fr::random_element();
+        tree->update_element(value);
+        expected.update_element(value);
+    }
+
+    // Reopening finds the same tree, which keeps growing from where it was
+    auto tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->root(), expected.root());
+    EXPECT_EQ(tree->get_leaves(), expected.get_leaves());
+    EXPECT_EQ(tree->get_hashes(), expected.get_hashes());
+
+    auto value = fr::random_element();
+    EXPECT_EQ(tree->update_element(value), expected.update_element(value));
+    EXPECT_EQ(tree->find_low_leaf(value), expected.find_low_leaf(value));
+
+    // Updates made under a checkpoint only reach the file once committed
+    tree->checkpoint();
+    tree->update_element(fr::random_element());
+    tree.reset();
+    tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->root(), expected.root());
+    EXPECT_EQ(tree->num_leaves(), expected.num_leaves());
+    tree.reset();
+
+    // A file holding a tree of another depth is rejected
+    EXPECT_EQ(IndexedMerkleTree<>::open(path, depth + 1), nullptr);
+
+    std::remove(path.c_str());
+    std::remove((path + ".journal").c_str());
+}
+
+std::vector<uint8_t> read_file(std::string const& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+void write_file(std::string const& path, std::vector<uint8_t> const& bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_persistent_tree_recovery)
+{
+    constexpr size_t depth = 6;
+    std::string path = "indexed_merkle_tree_recovery_test.db";
+    std::remove(path.c_str());
+    std::remove((path + ".journal").c_str());
+
+    // the file before and after a batch
+    std::vector<fr> values(20);
+    for (auto& value : values) {
+        value = fr::random_element();
+    }
+    IndexedMerkleTree before(depth);
+    before.update_elements(std::vector<fr>(values.begin(), values.begin() + 10));
+    IndexedMerkleTree after = before;
+    after.update_elements(std::vector<fr>(values.begin() + 10, values.end()));
+    IndexedMerkleTree<>::open(path, depth)->update_elements(std::vector<fr>(values.begin(), values.begin() + 10));
+    auto old_bytes = read_file(path);
+    IndexedMerkleTree<>::open(path, depth)->update_elements(std::vector<fr>(values.begin() + 10, values.end()));
+    auto new_bytes = read_file(path);
+    ASSERT_EQ(old_bytes.size(), new_bytes.size());
+
+    // a crash in the middle of writing the batch to the file, with only half of it there, is replayed from the journal
+    auto torn_bytes = old_bytes;
+    std::vector<std::pair<size_t, size_t>> writes;
+    for (size_t i = 0; i < new_bytes.size(); i++) {
+        if (old_bytes[i] != new_bytes[i]) {
+            if (writes.empty() || writes.back().first + writes.back().second != i) {
+                writes.emplace_back(i, 0);
+            }
+            writes.back().second++;
+        }
+    }
+    {
+        redo_journal journal(path + ".journal");
+        for (size_t w = 0; w < writes.size(); w++) {
+            journal.add(writes[w].first, &new_bytes[writes[w].first], writes[w].second);
+            if (w % 2 == 0) {
+                std::copy_n(&new_bytes[writes[w].first], writes[w].second, &torn_bytes[writes[w].first]);
+            }
+        }
+        ASSERT_TRUE(journal.write());
+    }
+    write_file(path, torn_bytes);
+    auto tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->root(), after.root());
+    EXPECT_EQ(tree->get_leaves(), after.get_leaves());
+    EXPECT_EQ(tree->get_hashes(), after.get_hashes());
+    tree.reset();
+
+    // a crash while writing the journal leaves the file as it was before the batch
+    {
+        redo_journal journal(path + ".journal");
+        for (auto const& [offset, length] : writes) {
+            journal.add(offset, &new_bytes[offset], length);
+        }
+        ASSERT_TRUE(journal.write());
+    }
+    write_file(path, old_bytes);
+    auto journal_bytes = read_file(path + ".journal");
+    journal_bytes.resize(journal_bytes.size() - 10);
+    write_file(path + ".journal", journal_bytes);
+    tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->root(), before.root());
+    EXPECT_EQ(tree->get_leaves(), before.get_leaves());
+    tree.reset();
+
+    // a leaf pointing past the last leaf is rejected, though the root matches
+    auto bad_bytes = old_bytes;
+    const size_t next_index_offset =
+        4096 + node_store::dense_size(depth) * sizeof(fr) + sizeof(compact_leaf) + offsetof(compact_leaf, nextIndex);
+    bad_bytes[next_index_offset] = 200;
+    write_file(path, bad_bytes);
+    EXPECT_EQ(IndexedMerkleTree<>::open(path, depth), nullptr);
+
+    std::remove(path.c_str());
+    std::remove((path + ".journal").c_str());
+}
+
+TEST(stdlib_indexed_merkle_tree, test_persistent_tree_journal_failure)
+{
+    constexpr size_t depth = 6;
+    std::string path = "indexed_merkle_tree_journal_test.db";
+    std::remove(path.c_str());
+    std::remove((path + ".journal").c_str());
+
+    std::vector<fr> values(10);
+    for (auto& value : values) {
+        value = fr::random_element();
+    }
+    IndexedMerkleTree expected(depth);
+    expected.update_elements(values);
+    IndexedMerkleTree<>::open(path, depth)->update_elements(values);
+
+    // every write to the journal fails, as on a full disk
+    std::remove((path + ".journal").c_str());
+    std::filesystem::create_symlink("/dev/full", path + ".journal");
+    auto tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    auto value = fr::random_element();
+    EXPECT_EQ(tree->update_element(value), fr(0));
+    EXPECT_TRUE(tree->update_elements({ value }).low_leaves.empty());
+    EXPECT_EQ(tree->root(), expected.root());
+    EXPECT_EQ(tree->num_leaves(), expected.num_leaves());
+    EXPECT_FALSE(tree->find_low_leaf(value).second);
+
+    // an explicit commit fails with the checkpoint still open
+    tree->checkpoint();
+    tree->update_element(value);
+    EXPECT_FALSE(tree->commit());
+    EXPECT_NE(tree->root(), expected.root());
+    tree->revert();
+    EXPECT_EQ(tree->root(), expected.root());
+    tree.reset();
+
+    // nothing of the failed commits reached the file
+    std::remove((path + ".journal").c_str());
+    tree = IndexedMerkleTree<>::open(path, depth);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->root(), expected.root());
+    EXPECT_EQ(tree->get_leaves(), expected.get_leaves());
+    EXPECT_EQ(tree->get_hashes(), expected.get_hashes());
+    tree.reset();
+
+    std::remove(path.c_str());
+    std::remove((path + ".journal").c_str());
+}
+#endif
+
+#ifndef __wasm__
+TEST(stdlib_indexed_merkle_tree, test_concurrent_readers)
+{
+    constexpr size_t depth = 8;
+    constexpr size_t num_readers = 4;
+    IndexedMerkleTree tree(depth);
+
+    std::atomic<bool> done = false;
+    std::vector<std::vector<fr>> seen_roots(num_readers);
+    std::vector<size_t> inconsistent(num_readers, 0);
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < num_readers; r++) {
+        readers.emplace_back([&, r]() {
+            for (size_t i = 0; !done; i = (i + 1) % 64) {
+                auto [root, path] = tree.get_committed_hash_path(i);
+
+                // the path must hash up to the root it was returned with
+                auto current = (i & 1) ? path[0].second : path[0].first;
+                size_t index = i;
+                for (size_t l = 0; l < depth; l++) {
+                    current = compress_pair((index & 1) ? path[l].first : current,
+                                            (index & 1) ? current : path[l].second);
+                    index >>= 1;
+                    if (l + 1 < depth && current != ((index & 1) ? path[l + 1].second : path[l + 1].first)) {
+                        break;
+                    }
+                }
+                inconsistent[r] += (current != root);
+                seen_roots[r].push_back(root);
+            }
+        });
+    }
+
+    std::vector<fr> roots = { tree.root() };
+    for (size_t i = 0; i < 20; i++) {
+        if (i % 2 == 0) {
+            roots.push_back(tree.update_element(fr::random_element()));
+        } else {
+            roots.push_back(tree.update_elements({ fr::random_element(), fr::random_element() }).root);
+        }
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    // readers only ever see committed roots, with paths matching them
+    for (size_t r = 0; r < num_readers; r++) {
+        EXPECT_EQ(inconsistent[r], 0UL);
+        for (auto const& root : seen_roots[r]) {
+            EXPECT_NE(std::find(roots.begin(), roots.end(), root), roots.end());
+        }
+    }
+    EXPECT_EQ(tree.get_committed_hash_path(3).first, tree.root());
+    EXPECT_EQ(tree.get_committed_hash_path(3).second, tree.get_hash_path(3));
+}
+#endif
+
+TEST(stdlib_indexed_merkle_tree, test_hash_multiproof)
+{
+    constexpr size_t depth = 6;
+    IndexedMerkleTree tree(depth);
+    for (size_t i = 0; i < 20; i++) {
+        tree.update_element(fr::random_element());
+    }
+
+    // A single leaf needs the siblings along its path
+    std::vector<size_t> single = { 5 };
+    auto proof = tree.get_hash_paths(single);
+    auto path = tree.get_hash_path(5);
+    ASSERT_EQ(proof.nodes.size(), depth);
+    for (size_t l = 0; l < depth; l++) {
+        EXPECT_EQ(proof.nodes[l], ((5UL >> l) & 1) ? path[l].first : path[l].second);
+    }
+
+    // Shared nodes are sent once, nodes computed from other proven leaves are not sent
+    std::vector<size_t> indices = { 13, 3, 0, 2, 3, 12, 40 };
+    proof = tree.get_hash_paths(indices);
+    EXPECT_EQ(proof.indices, std::vector<size_t>({ 0, 2, 3, 12, 13, 40 }));
+    EXPECT_LT(proof.nodes.size(), 4 * depth);
+
+    std::vector<leaf> leaves;
+    for (auto index : proof.indices) {
+        leaves.push_back(index < tree.num_leaves() ? tree.get_leaf(index) : leaf({ 0, 0, 0 }));
+    }
+    EXPECT_TRUE(check_hash_paths(tree.root(), depth, proof, leaves));
+
+    // Any change to the leaves or to the proof is caught
+    auto wrong_leaves = leaves;
+    wrong_leaves[1].value += 1;
+    EXPECT_FALSE(check_hash_paths(tree.root(), depth, proof, wrong_leaves));
+    auto wrong_proof = proof;
+    wrong_proof.nodes.pop_back();
+    EXPECT_FALSE(check_hash_paths(tree.root(), depth, wrong_proof, leaves));
+    wrong_proof = proof;
+    wrong_proof.nodes.push_back(fr::zero());
+    EXPECT_FALSE(check_hash_paths(tree.root(), depth, wrong_proof, leaves));
+    wrong_proof = proof;
+    std::swap(wrong_proof.indices[0], wrong_proof.indices[1]);
+    EXPECT_FALSE(check_hash_paths(tree.root(), depth, wrong_proof, leaves));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_metrics)
+{
+    constexpr size_t depth = 8;
+    IndexedMerkleTree tree(depth);
+    tree.update_element(fr::random_element());
+
+    metrics::reset();
+    tree.update_element(fr::random_element());
+    auto snapshot = metrics::snapshot();
+
+    if constexpr (!metrics::enabled) {
+        EXPECT_EQ(snapshot, metrics_snapshot({ 0, 0, 0, 0 }));
+        return;
+    }
+    EXPECT_EQ(snapshot.leaves_inserted, 1UL);
+    EXPECT_EQ(snapshot.low_leaf_searches, 1UL);
+
+    // the paths of the new leaf and of its low leaf are rehashed, up to where they meet
+    EXPECT_GE(snapshot.nodes_rehashed, depth - 1);
+    EXPECT_LE(snapshot.nodes_rehashed, 2 * (depth - 1));
+    // on top of these, the two leaves and the root are hashed
+    EXPECT_EQ(snapshot.compressions, snapshot.nodes_rehashed + 3);
+}
+
+TEST(stdlib_indexed_merkle_tree, test_flat_format)
+{
+    constexpr size_t depth = 5;
+    IndexedMerkleTree tree(depth);
+    for (size_t i = 0; i < 11; i++) {
+        tree.update_element(fr::random_element());
+    }
+
+    // leaves and hash paths
+    std::vector<leaf> leaves = tree.get_leaves();
+    std::vector<uint8_t> leaf_buffer(leaves.size() * flat::LEAF_SIZE);
+    EXPECT_EQ(flat::write_leaves(leaves, leaf_buffer.data()), leaf_buffer.size());
+    for (size_t i = 0; i < leaves.size(); i++) {
+        EXPECT_EQ(flat::leaf_view(leaf_buffer.data() + i * flat::LEAF_SIZE).get(), leaves[i]);
+    }
+
+    auto path = tree.get_hash_path(6);
+    std::vector<uint8_t> path_buffer(flat::hash_path_size(depth));
+    EXPECT_EQ(flat::write_hash_path(path, path_buffer.data()), path_buffer.size());
+    EXPECT_EQ(flat::hash_path_view(path_buffer.data(), depth).get(), path);
+
+    // whole tree
+    std::vector<uint8_t> buffer(tree.flat_size());
+    EXPECT_EQ(tree.write_flat(buffer.data()), buffer.size());
+    flat::tree_view view(buffer.data(), buffer.size());
+    ASSERT_TRUE(view.is_valid());
+    EXPECT_EQ(view.root(), tree.root());
+    EXPECT_EQ(view.num_leaves(), tree.num_leaves());
+    for (size_t i = 0; i < (1UL << depth); i++) {
+        EXPECT_EQ(view.get_hash_path(i), tree.get_hash_path(i));
+        view.write_hash_path(i, path_buffer.data());
+        EXPECT_EQ(flat::hash_path_view(path_buffer.data(), depth).get(), tree.get_hash_path(i));
+    }
+    for (size_t i = 0; i < tree.num_leaves(); i++) {
+        EXPECT_EQ(view.leaf_at(i).get(), tree.get_leaf(i));
+    }
+
+    // restored trees carry on like the original
+    fr value = fr::random_element();
+    fr expected_root = tree.update_element(value);
+    for (auto mode : { storage_mode::DENSE, storage_mode::SPARSE }) {
+        auto restored = IndexedMerkleTree<>::from_flat(view, mode);
+        ASSERT_NE(restored, nullptr);
+        EXPECT_EQ(restored->root(), view.root());
+        EXPECT_EQ(restored->update_element(value), expected_root);
+        EXPECT_EQ(restored->get_hashes(), tree.get_hashes());
+        EXPECT_EQ(restored->get_leaves(), tree.get_leaves());
+    }
+
+    // truncated and corrupted buffers
+    EXPECT_FALSE(flat::tree_view(buffer.data(), buffer.size() - 1).is_valid());
+    buffer[4 * sizeof(uint64_t)] ^= 1;
+    EXPECT_EQ(IndexedMerkleTree<>::from_flat(flat::tree_view(buffer.data(), buffer.size())), nullptr);
+    buffer[0] ^= 1;
+    EXPECT_FALSE(flat::tree_view(buffer.data(), buffer.size()).is_valid());
+}
+
+TEST(stdlib_indexed_merkle_tree, test_hash_batch)
+{
+    // an empty batch, one below the threshold, one above it that does not split evenly across the threads
+    for (size_t n : { size_t(0), PARALLEL_HASH_THRESHOLD / 2, 4 * PARALLEL_HASH_THRESHOLD + 1 }) {
+        std::vector<fr> children(2 * n);
+        std::vector<compact_leaf> leaves(n);
+        for (size_t i = 0; i < n; i++) {
+            children[2 * i] = fr::random_element();
+            children[2 * i + 1] = fr::random_element();
+            leaves[i] = { fr::random_element(), fr::random_element(), static_cast<uint32_t>(i) };
+        }
+
+        std::vector<fr> parents(n);
+        std::vector<fr> hashes(n);
+        compress_pairs(children, parents);
+        hash_leaves(leaves, hashes);
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_EQ(parents[i], compress_pair(children[2 * i], children[2 * i + 1]));
+            EXPECT_EQ(hashes[i], leaves[i].hash());
+        }
+    }
+}
+
+template <typename Hasher> void check_hasher()
+{
+    constexpr size_t depth = 4;
+    IndexedMerkleTree<Hasher> tree(depth);
+    IndexedMerkleTree<Hasher> batch_tree(depth);
+    std::vector<fr> values(6);
+    for (auto& value : values) {
+        value = fr::random_element();
+        tree.update_element(value);
+    }
+    EXPECT_EQ(batch_tree.update_elements(values).root, tree.root());
+
+    auto leaves = tree.get_leaves();
+    for (size_t i = 0; i < leaves.size(); i++) {
+        EXPECT_TRUE(check_hash_path<Hasher>(tree.root(), tree.get_hash_path(i), leaves[i], i));
+    }
+    std::vector<size_t> indices = { 1, 4 };
+    EXPECT_TRUE(check_hash_paths<Hasher>(tree.root(), depth, tree.get_hash_paths(indices), { leaves[1], leaves[4] }));
+}
+
+TEST(stdlib_indexed_merkle_tree, test_hashers)
+{
+    check_hasher<pedersen_hasher>();
+    check_hasher<blake3s_hasher>();
+    check_hasher<sha256_hasher>();
+
+    EXPECT_NE(IndexedMerkleTree<blake3s_hasher>(4).root(), IndexedMerkleTree<pedersen_hasher>(4).root());
+    EXPECT_NE(IndexedMerkleTree<sha256_hasher>(4).root(), IndexedMerkleTree<blake3s_hasher>(4).root());
+}
+
+TEST(stdlib_indexed_merkle_tree, test_update_element_internal)
+{
+    constexpr size_t depth = 4;
+    IndexedMerkleTree tree(depth);
+    IndexedMerkleTree batch_tree(depth);
+
+    // expected nodes, level after level
+    std::vector<fr> expected = tree.get_hashes();
+    std::vector<std::pair<size_t, fr>> writes;
+    for (size_t index : { 3UL, 12UL, 3UL, 0UL }) {
+        fr value = fr::random_element();
+        writes.push_back({ index, value });
+        expected[index] = value;
+        fr root = tree.update_element_internal(index, value);
+
+        size_t offset = 0;
+        for (size_t l = 1; l < depth; l++) {
+            size_t level_size = 1UL << (depth - l);
+            for (size_t i = 0; i < level_size; i++) {
+                expected[offset + 2 * level_size + i] =
+                    compress_pair(expected[offset + 2 * i], expected[offset + 2 * i + 1]);
+            }
+            offset += 2 * level_size;
+        }
+        EXPECT_EQ(tree.get_hashes(), expected);
+        EXPECT_EQ(root, compress_pair(expected[expected.size() - 2], expected[expected.size() - 1]));
+    }
+
+    // one shared rehash, the last write to an index wins
+    EXPECT_EQ(batch_tree.update_elements_internal(writes), tree.root());
+    EXPECT_EQ(batch_tree.get_hashes(), tree.get_hashes());
+}
+
+TEST(stdlib_indexed_merkle_tree, test_apply_leaf_updates)
+{
+    constexpr size_t depth = 10;
+    std::vector<fr> values(300);
+    for (auto& value : values) {
+        value = fr::random_element();
+    }
+    IndexedMerkleTree behind(depth);
+    behind.update_elements(std::vector<fr>(values.begin(), values.begin() + 100));
+    IndexedMerkleTree ahead(depth);
+    ahead.update_elements(values);
+
+    // the diff between the two states, streamed in its serialized form
+    std::vector<uint8_t> stream;
+    auto old_leaves = behind.get_leaves();
+    auto new_leaves = ahead.get_leaves();
+    for (size_t i = 0; i < new_leaves.size(); i++) {
+        if (i >= old_leaves.size() || !(old_leaves[i] == new_leaves[i])) {
+            leaf_update({ i, new_leaves[i] }).write(stream);
+        }
+    }
+    std::vector<leaf_update> updates;
+    for (uint8_t const* it = stream.data(); it != stream.data() + stream.size();) {
+        updates.emplace_back().read(it);
+    }
+
+    for (auto mode : { storage_mode::DENSE, storage_mode::BLOCKED, storage_mode::SPARSE }) {
+        IndexedMerkleTree tree(depth, mode);
+        tree.update_elements(std::vector<fr>(values.begin(), values.begin() + 100));
+        EXPECT_EQ(tree.apply_leaf_updates(updates), ahead.root());
+        EXPECT_EQ(tree.get_hashes(), ahead.get_hashes());
+        if (mode != storage_mode::SPARSE) {
+            EXPECT_EQ(tree.get_committed_hash_path(7).first, ahead.root());
+        }
+
+        // the leaf index has followed, so the tree can carry on inserting
+        fr value = fr::random_element();
+        EXPECT_EQ(tree.find_low_leaf(value), ahead.find_low_leaf(value));
+    }
+
+    // a value replayed at two indexes in one batch is indexed at the last one, and a value moved to another leaf
+    // follows it even if its old leaf is only overwritten afterwards
+    IndexedMerkleTree tree(depth);
+    tree.update_elements(std::vector<fr>(values.begin(), values.begin() + 100));
+    const size_t n = tree.num_leaves();
+    fr value = fr::random_element();
+    tree.apply_leaf_updates({ { n, { value, 0, 0 } }, { n + 1, { value, 0, 0 } } });
+    EXPECT_EQ(tree.find_low_leaf(value), std::make_pair(n + 1, true));
+
+    fr moved = tree.get_leaf(1).value;
+    fr replacement = fr::random_element();
+    tree.apply_leaf_updates({ { n + 2, { moved, 0, 0 } }, { 1, { replacement, 0, 0 } } });
+    EXPECT_EQ(tree.find_low_leaf(moved), std::make_pair(n + 2, true));
+    EXPECT_EQ(tree.find_low_leaf(replacement), std::make_pair(size_t(1), true));
+    EXPECT_FALSE(tree.prove_non_membership(moved).has_value());
+}
+
+TEST(stdlib_indexed_merkle_tree, test_update_scheduler)
+{
+    constexpr size_t depth = 10;
+    std::vector<std::vector<fr>> batches(8);
+    for (auto& batch : batches) {
+        for (size_t i = 0; i < 16; i++) {
+            batch.push_back(fr::random_element());
+        }
+    }
+    IndexedMerkleTree expected(depth);
+    std::vector<batch_update_result> expected_results;
+    for (auto& batch : batches) {
+        expected_results.push_back(expected.update_elements(batch));
+    }
+
+    // two trees updated side by side, the batches of each one in order, even with a single thread for both
+    for (size_t num_threads : { 1UL, 2UL }) {
+        async::task_pool pool(num_threads);
+        IndexedMerkleTree first(depth);
+        IndexedMerkleTree second(depth);
+        auto control = std::make_shared<async::task_control>();
+        update_scheduler first_updates(first, pool, control);
+        update_scheduler second_updates(second, pool);
+        std::vector<std::future<batch_update_result>> first_results;
+        std::vector<std::future<batch_update_result>> second_results;
+        for (auto& batch : batches) {
+            first_results.push_back(first_updates.update_elements(batch));
+            second_results.push_back(second_updates.update_elements(batch));
+        }
+        for (size_t i = 0; i < batches.size(); i++) {
+            auto first_result = first_results[i].get();
+            EXPECT_EQ(first_result.root, expected_results[i].root);
+            EXPECT_EQ(first_result.low_leaves, expected_results[i].low_leaves);
+            EXPECT_EQ(second_results[i].get().root, expected_results[i].root);
+        }
+        second_updates.wait();
+        EXPECT_EQ(first.get_hashes(), expected.get_hashes());
+        EXPECT_EQ(second.get_leaves(), expected.get_leaves());
+        EXPECT_EQ(control->progress(), 1.0);
+    }
+
+    // once cancelled, the updates that have not started are skipped
+    async::task_pool pool(2);
+    IndexedMerkleTree tree(depth);
+    auto control = std::make_shared<async::task_control>();
+    update_scheduler updates(tree, pool, control);
+    EXPECT_EQ(updates.update_elements(batches[0]).get().root, expected_results[0].root);
+    EXPECT_EQ(control->progress(), 1.0);
+    control->cancel();
+    auto skipped = updates.update_elements(batches[1]).get();
+    EXPECT_EQ(skipped.root, expected_results[0].root);
+    EXPECT_TRUE(skipped.low_leaves.empty());
+    EXPECT_EQ(updates.apply_leaf_updates({ { tree.num_leaves(), { fr::random_element(), 0, 0 } } }).get(),
+              expected_results[0].root);
+    updates.wait();
+    EXPECT_EQ(tree.num_leaves(), batches[0].size() + 1);
+    EXPECT_LT(control->progress(), 1.0);
+}
+
+TEST(stdlib_indexed_merkle_tree, test_fixed_depth_tree)
+{
+    constexpr size_t depth = 8;
+    std::vector<fr> values(100);
+    for (auto& value : values) {
+        value = fr::random_element();
+    }
+    static_assert(FixedDepthIndexedMerkleTree<depth>::level_offset(1) == 256);
+    static_assert(FixedDepthIndexedMerkleTree<depth>::level_offset(depth - 1) == node_store::dense_size(depth) - 2);
+
+    for (auto mode : { storage_mode::DENSE, storage_mode::BLOCKED, storage_mode::SPARSE }) {
+        FixedDepthIndexedMerkleTree<depth> tree(mode);
+        IndexedMerkleTree expected(depth, mode);
+        EXPECT_EQ(tree.update_elements(values).root, expected.update_elements(values).root);
+
+        // the dense reads, then the reads through an open checkpoint
+        for (bool checkpointed : { false, true }) {
+            if (checkpointed) {
+                tree.checkpoint();
+                expected.checkpoint();
+                EXPECT_EQ(tree.update_element(values[0] + 1), expected.update_element(values[0] + 1));
+            }
+            for (size_t index : { 0UL, 5UL, 99UL, 100UL, 255UL }) {
+                auto path = tree.get_hash_path(index);
+                auto expected_path = expected.get_hash_path(index);
+                EXPECT_TRUE(std::equal(path.begin(), path.end(), expected_path.begin(), expected_path.end()));
+            }
+        }
+    }
+}
+
+TEST(stdlib_indexed_merkle_tree, test_prove_non_membership)
+{
+    constexpr size_t depth = 12;
+    std::vector<fr> values(2000);
+    for (auto& value : values) {
+        value = fr::random_element();
+    }
+    IndexedMerkleTree tree(depth);
+    tree.update_elements(values);
+    EXPECT_FALSE(tree.prove_non_membership(values[7]).has_value());
+    EXPECT_FALSE(tree.prove_non_membership(0).has_value());
+
+    std::vector<fr> queries(20);
+    for (auto& query : queries) {
+        query = fr::random_element();
+    }
+    auto check_proofs = [&](IndexedMerkleTree<>& committed) {
+        for (auto const& query : queries) {
+            auto proof = tree.prove_non_membership(query);
+            ASSERT_TRUE(proof.has_value());
+            EXPECT_EQ(proof->root, committed.root());
+            EXPECT_EQ(proof->index, committed.find_low_leaf(query).first);
+            EXPECT_EQ(proof->low_leaf, committed.get_leaf(proof->index));
+            EXPECT_LT(uint256_t(proof->low_leaf.value), uint256_t(query));
+            EXPECT_TRUE(proof->low_leaf.nextValue == 0 || uint256_t(query) < uint256_t(proof->low_leaf.nextValue));
+            EXPECT_EQ(proof->path, committed.get_hash_path(proof->index));
+            EXPECT_TRUE(check_hash_path(proof->root, proof->path, proof->low_leaf, proof->index));
+        }
+    };
+    check_proofs(tree);
+
+    // updates staged in a checkpoint are not proved against until they are committed
+    auto committed = tree;
+    tree.checkpoint();
+    std::vector<fr> staged(queries.begin(), queries.begin() + 5);
+    tree.update_elements(staged);
+    check_proofs(committed);
+    EXPECT_TRUE(tree.prove_non_membership(staged[0]).has_value());
+    tree.revert();
+    check_proofs(committed);
+
+    tree.update_elements(staged);
+    EXPECT_FALSE(tree.prove_non_membership(staged[0]).has_value());
+    queries.erase(queries.begin(), queries.begin() + 5);
+    check_proofs(tree);
+
+    // overwritten leaves are dropped from the index on commit
+    auto leaf = tree.get_leaf(1);
+    fr replacement = fr::random_element();
+    tree.apply_leaf_updates({ { 1, { replacement, leaf.nextIndex, leaf.nextValue } } });
+    EXPECT_TRUE(tree.prove_non_membership(leaf.value).has_value());
+    EXPECT_FALSE(tree.prove_non_membership(replacement).has_value());
+    EXPECT_EQ(tree.find_low_leaf(replacement).first, 1UL);
+
+    // the same proofs in a sparse tree
+    IndexedMerkleTree sparse(depth, storage_mode::SPARSE);
+    sparse.update_elements(values);
+    for (auto const& query : queries) {
+        auto proof = sparse.prove_non_membership(query);
+        ASSERT_TRUE(proof.has_value());
+        EXPECT_EQ(proof->root, sparse.root());
+        EXPECT_EQ(proof->path, sparse.get_hash_path(proof->index));
+        EXPECT_TRUE(check_hash_path(proof->root, proof->path, proof->low_leaf, proof->index));
+    }
+    EXPECT_FALSE(sparse.prove_non_membership(values[7]).has_value());
+}
+
+#ifndef __wasm__
+TEST(stdlib_indexed_merkle_tree, test_concurrent_non_membership_proofs)
+{
+    constexpr size_t depth = 8;
+    constexpr size_t num_readers = 4;
+    // sparse levels are reallocated by the commits the readers run into
+    for (auto mode : { storage_mode::DENSE, storage_mode::SPARSE }) {
+        IndexedMerkleTree tree(depth, mode);
+
+        std::atomic<bool> done = false;
+        std::vector<std::vector<fr>> seen_roots(num_readers);
+        std::vector<size_t> inconsistent(num_readers, 0);
+        std::vector<std::thread> readers;
+        for (size_t r = 0; r < num_readers; r++) {
+            readers.emplace_back([&, r]() {
+                while (!done) {
+                    fr query = fr::random_element();
+                    auto proof = tree.prove_non_membership(query);
+                    if (!proof.has_value()) {
+                        continue;
+                    }
+                    bool covers = uint256_t(proof->low_leaf.value) < uint256_t(query) &&
+                                  (proof->low_leaf.nextValue == 0 ||
+                                   uint256_t(query) < uint256_t(proof->low_leaf.nextValue));
+                    inconsistent[r] +=
+                        !covers || !check_hash_path(proof->root, proof->path, proof->low_leaf, proof->index);
+                    seen_roots[r].push_back(proof->root);
+                }
+            });
+        }
+
+        std::vector<fr> roots = { tree.root() };
+        for (size_t i = 0; i < 20; i++) {
+            roots.push_back(tree.update_elements({ fr::random_element(), fr::random_element() }).root);
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        // proofs always lead to a committed root
+        for (size_t r = 0; r < num_readers; r++) {
+            EXPECT_EQ(inconsistent[r], 0UL);
+            for (auto const& root : seen_roots[r]) {
+                EXPECT_NE(std::find(roots.begin(), roots.end(), root), roots.end());
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,242 @@
+#include "journal.hpp"
+#include <algorithm>
+#include <cstring>
+#ifndef __wasm__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+namespace {
+
+constexpr uint64_t journal_magic = 0x4c4e524a544d49ULL; // "IMTJRNL"
+constexpr size_t journal_header_size = 3 * sizeof(uint64_t);
+// writes within the same page of the file are synced together
+constexpr size_t page_size = 4096;
+
+// FNV-1a, to tell a complete batch from a torn one
+uint64_t checksum(uint8_t const* data, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t read_u64(uint8_t const* data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void append_u64(std::vector<uint8_t>& buffer, uint64_t value)
+{
+    auto const* bytes = reinterpret_cast<uint8_t const*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+#ifndef __wasm__
+bool write_all(int fd, uint8_t const* data, size_t length, size_t offset)
+{
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, static_cast<off_t>(offset));
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        offset += static_cast<size_t>(written);
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+#endif
+
+} // namespace
+
+/**
+ * Open the journal at `path`, creating it empty if it does not exist.
+ */
+redo_journal::redo_journal(std::string const& path)
+{
+#ifndef __wasm__
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        return;
+    }
+    // the new journal's entry must itself be durable
+    auto slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    int dir_fd = ::open(directory.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+#else
+    static_cast<void>(path);
+#endif
+}
+
+redo_journal::~redo_journal()
+{
+    close();
+}
+
+redo_journal::redo_journal(redo_journal&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1))
+    , records_(std::move(other.records_))
+    , ranges_(std::move(other.ranges_))
+{}
+
+redo_journal& redo_journal::operator=(redo_journal const& other)
+{
+    if (this != &other) {
+        close();
+    }
+    return *this;
+}
+
+redo_journal& redo_journal::operator=(redo_journal&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        fd_ = std::exchange(other.fd_, -1);
+        records_ = std::move(other.records_);
+        ranges_ = std::move(other.ranges_);
+    }
+    return *this;
+}
+
+/**
+ * A journal is complete if its checksum matches its records and every record lies within `file`. Any other journal is
+ * the remainder of a batch that was interrupted before the file was written to, and is dropped.
+ */
+void redo_journal::replay(mapped_file const& file)
+{
+#ifndef __wasm__
+    if (!is_open() || !file.is_open()) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) < journal_header_size) {
+        clear();
+        return;
+    }
+    std::vector<uint8_t> journal(static_cast<size_t>(st.st_size));
+    if (pread(fd_, journal.data(), journal.size(), 0) != static_cast<ssize_t>(journal.size())) {
+        clear();
+        return;
+    }
+
+    const uint64_t length = read_u64(&journal[sizeof(uint64_t)]);
+    if (read_u64(&journal[0]) != journal_magic || length != journal.size() - journal_header_size ||
+        read_u64(&journal[2 * sizeof(uint64_t)]) != checksum(&journal[journal_header_size], length)) {
+        clear();
+        return;
+    }
+
+    struct record {
+        uint64_t offset;
+        uint64_t size;
+        size_t at;
+    };
+    std::vector<record> records;
+    for (size_t at = journal_header_size; at < journal.size();) {
+        if (journal.size() - at < 2 * sizeof(uint64_t)) {
+            clear();
+            return;
+        }
+        const uint64_t offset = read_u64(&journal[at]);
+        const uint64_t size = read_u64(&journal[at + sizeof(uint64_t)]);
+        at += 2 * sizeof(uint64_t);
+        if (size > journal.size() - at || offset > file.size() || size > file.size() - offset) {
+            clear();
+            return;
+        }
+        records.push_back({ offset, size, at });
+        at += size;
+    }
+    // every record was checked before any is applied, replaying twice is harmless if this is interrupted
+    for (auto const& [offset, size, at] : records) {
+        std::memcpy(file.data() + offset, &journal[at], size);
+        file.sync(offset, size);
+    }
+#else
+    static_cast<void>(file);
+#endif
+    clear();
+}
+
+void redo_journal::add(size_t offset, void const* data, size_t length)
+{
+    append_u64(records_, offset);
+    append_u64(records_, length);
+    auto const* bytes = static_cast<uint8_t const*>(data);
+    records_.insert(records_.end(), bytes, bytes + length);
+    ranges_.emplace_back(offset, length);
+}
+
+bool redo_journal::write()
+{
+#ifndef __wasm__
+    if (!is_open()) {
+        return false;
+    }
+    std::vector<uint8_t> header;
+    append_u64(header, journal_magic);
+    append_u64(header, records_.size());
+    append_u64(header, checksum(records_.data(), records_.size()));
+    return write_all(fd_, header.data(), header.size(), 0) &&
+           write_all(fd_, records_.data(), records_.size(), journal_header_size) &&
+           ftruncate(fd_, static_cast<off_t>(journal_header_size + records_.size())) == 0 && fdatasync(fd_) == 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<std::pair<size_t, size_t>> redo_journal::dirty_pages() const
+{
+    std::vector<std::pair<size_t, size_t>> ranges = ranges_;
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<size_t, size_t>> pages;
+    for (auto const& [offset, length] : ranges) {
+        if (!pages.empty() && offset / page_size <= (pages.back().first + pages.back().second) / page_size) {
+            pages.back().second = std::max(pages.back().second, offset + length - pages.back().first);
+        } else {
+            pages.emplace_back(offset, length);
+        }
+    }
+    return pages;
+}
+
+void redo_journal::clear()
+{
+    records_.clear();
+    ranges_.clear();
+#ifndef __wasm__
+    if (is_open() && ftruncate(fd_, 0) == 0) {
+        fdatasync(fd_);
+    }
+#endif
+}
+
+void redo_journal::close()
+{
+#ifndef __wasm__
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+    fd_ = -1;
+    records_.clear();
+    ranges_.clear();
+}
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
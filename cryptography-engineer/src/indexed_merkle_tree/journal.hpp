@@ -0,0 +1,64 @@
+#pragma once
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Redo journal of a file written in place through a `mapped_file`, kept in a file of its own.
+ *
+ * The pages of a shared mapping can be written back to the file at any time, so a batch of writes is first recorded
+ * in the journal, with a checksum, and synced there before any of it is applied to the mapping. Once the batch is on
+ * disk in the file itself, the journal is cleared. After a crash, a complete journal is replayed into the file and a
+ * torn one is dropped: either way the file holds exactly one batch, the last one committed.
+ *
+ *   journal: | magic | length of the records: u64 | checksum of the records: u64 | records |
+ *   record:  | offset in the file: u64 | length: u64 | bytes |
+ *
+ * A copy of a journal is detached like a copy of a mapped file. Not available on WASM, where `is_open` is always false.
+ */
+class redo_journal {
+  public:
+    redo_journal() = default;
+    explicit redo_journal(std::string const& path);
+    ~redo_journal();
+
+    redo_journal(redo_journal const&) {}
+    redo_journal(redo_journal&& other) noexcept;
+    redo_journal& operator=(redo_journal const& other);
+    redo_journal& operator=(redo_journal&& other) noexcept;
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // Applies the batch of a complete journal to `file` and syncs it there, then clears the journal
+    void replay(mapped_file const& file);
+
+    // Records the write of `length` bytes at `offset` of the file in the pending batch
+    void add(size_t offset, void const* data, size_t length);
+
+    // Writes the pending batch to the journal and waits for it to be on disk, false if it could not be written
+    bool write();
+
+    // Byte ranges of the file written by the pending batch, as (offset, length) sorted and merged by page
+    std::vector<std::pair<size_t, size_t>> dirty_pages() const;
+
+    // Drops the pending batch and empties the journal, once the batch is on disk in the file
+    void clear();
+
+  private:
+    void close();
+
+    int fd_ = -1;
+    std::vector<uint8_t> records_;
+    std::vector<std::pair<size_t, size_t>> ranges_;
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
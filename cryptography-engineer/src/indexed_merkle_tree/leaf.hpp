@@ -1,6 +1,8 @@
 #pragma once
 #include <stdlib/primitives/field/field.hpp>
-#include <crypto/pedersen/pedersen.hpp>
+#include "hasher.hpp"
+#include "metrics.hpp"
+#include <cstring>
 
 namespace plonk {
 namespace stdlib {
@@ -38,12 +40,56 @@ struct leaf {
         write(buf, nextValue);
     }
 
-    barretenberg::fr hash() const { return crypto::pedersen::compress_native({ value, nextIndex, nextValue }); }
+    template <typename Hasher = pedersen_hasher> barretenberg::fr hash() const
+    {
+        metrics::add(metrics::COMPRESSIONS);
+        return Hasher::hash_leaf(value, nextIndex, nextValue);
+    }
+};
+
+/**
+ * Field element stored as its raw limbs. `fr` is aligned to 32 bytes, which would pad every record holding one next to
+ * a smaller field up to a multiple of 32: the limbs alone only need the alignment of a 64-bit word.
+ */
+struct packed_fr {
+    uint64_t limbs[4];
+
+    packed_fr() = default;
+    packed_fr(fr const& value) { std::memcpy(limbs, value.data, sizeof(limbs)); }
+
+    operator fr() const
+    {
+        fr value;
+        std::memcpy(value.data, limbs, sizeof(limbs));
+        return value;
+    }
 };
 
+/**
+ * In-memory form of a leaf. A tree holds at most 2^32 leaves, so the next index is kept in 32 bits and is only widened
+ * back to the full pre-image when the leaf is hashed or handed out. With packed fields, a leaf takes 72 bytes rather
+ * than the 96 of `leaf`.
+ */
+struct compact_leaf {
+    packed_fr value;
+    packed_fr nextValue;
+    uint32_t nextIndex;
+
+    leaf expand() const { return { value, nextIndex, nextValue }; }
+
+    template <typename Hasher = pedersen_hasher> barretenberg::fr hash() const
+    {
+        return expand().template hash<Hasher>();
+    }
+};
+
+static_assert(sizeof(compact_leaf) == 72, "the arena, the file of a persistent tree and the flat format rely on it");
+
+template <typename Hasher = pedersen_hasher>
 inline barretenberg::fr compress_pair(barretenberg::fr const& lhs, barretenberg::fr const& rhs)
 {
-    return crypto::pedersen::compress_native({ lhs, rhs });
+    metrics::add(metrics::COMPRESSIONS);
+    return Hasher::compress(lhs, rhs);
 }
 
 } // namespace indexed_merkle_tree
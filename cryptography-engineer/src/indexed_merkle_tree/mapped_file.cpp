@@ -0,0 +1,127 @@
+#include "mapped_file.hpp"
+#include <utility>
+#ifndef __wasm__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Map the file at `path`, creating it if it does not exist. An existing file must have exactly `size` bytes, otherwise
+ * it is left untouched and the mapped file is not open.
+ */
+mapped_file::mapped_file(std::string const& path, size_t size)
+{
+#ifndef __wasm__
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        close();
+        return;
+    }
+
+    auto existing_size = static_cast<size_t>(st.st_size);
+    if (existing_size == 0) {
+        // a new file is sparse and reads back as zeros until written to
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            close();
+            return;
+        }
+        created_ = true;
+    } else if (existing_size != size) {
+        close();
+        return;
+    }
+
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (ptr == MAP_FAILED) {
+        close();
+        return;
+    }
+    data_ = static_cast<uint8_t*>(ptr);
+    size_ = size;
+#else
+    static_cast<void>(path);
+    static_cast<void>(size);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1))
+    , data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+    , created_(std::exchange(other.created_, false))
+{}
+
+mapped_file& mapped_file::operator=(mapped_file const& other)
+{
+    if (this != &other) {
+        close();
+    }
+    return *this;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        fd_ = std::exchange(other.fd_, -1);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        created_ = std::exchange(other.created_, false);
+    }
+    return *this;
+}
+
+/**
+ * Write the dirty pages of the given byte range back to the file, and wait for them to be on disk.
+ */
+void mapped_file::sync(size_t offset, size_t length) const
+{
+#ifndef __wasm__
+    if (!is_open()) {
+        return;
+    }
+    // msync works on whole pages
+    auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset - (offset % page_size);
+    msync(data_ + start, offset + length - start, MS_SYNC);
+#else
+    static_cast<void>(offset);
+    static_cast<void>(length);
+#endif
+}
+
+void mapped_file::close()
+{
+#ifndef __wasm__
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+    created_ = false;
+}
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
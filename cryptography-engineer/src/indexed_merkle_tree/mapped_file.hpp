@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * A file of a fixed size, memory mapped for reading and writing. Writes through the mapping reach the file, `sync`
+ * blocks until they are on disk.
+ *
+ * A copy of a mapped file is detached: it does not refer to any file. A tree stored in a file can therefore be copied,
+ * the copy living in memory only. Not available on WASM, where `is_open` is always false.
+ */
+class mapped_file {
+  public:
+    mapped_file() = default;
+    mapped_file(std::string const& path, size_t size);
+    ~mapped_file();
+
+    mapped_file(mapped_file const&) {}
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file const& other);
+    mapped_file& operator=(mapped_file&& other) noexcept;
+
+    bool is_open() const { return data_ != nullptr; }
+
+    // Whether the file did not exist (or was empty) and has been created zero-filled
+    bool created() const { return created_; }
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    void sync(size_t offset, size_t length) const;
+    void sync() const { sync(0, size_); }
+
+  private:
+    void close();
+
+    int fd_ = -1;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool created_ = false;
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
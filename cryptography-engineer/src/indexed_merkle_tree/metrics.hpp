@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+struct metrics_snapshot {
+    uint64_t compressions;      // Pedersen compressions, of leaf pre-images and of pairs of nodes
+    uint64_t nodes_rehashed;    // internal nodes recomputed from their children
+    uint64_t leaves_inserted;   // leaves added by updates
+    uint64_t low_leaf_searches; // lookups of the low leaf of a value, each a search of the sorted leaf index
+
+    bool operator==(metrics_snapshot const&) const = default;
+};
+
+/**
+ * Counters of the work done by all the trees of the process, to be scraped for monitoring. They are only kept in builds
+ * with ENABLE_METRICS: otherwise counting compiles to nothing and snapshots are all zeros.
+ */
+namespace metrics {
+
+#ifdef ENABLE_METRICS
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+enum counter { COMPRESSIONS, NODES_REHASHED, LEAVES_INSERTED, LOW_LEAF_SEARCHES, NUM_COUNTERS };
+
+inline std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+inline void add(counter c, uint64_t value = 1)
+{
+    if constexpr (enabled) {
+        counters[c].fetch_add(value, std::memory_order_relaxed);
+    }
+}
+
+inline metrics_snapshot snapshot()
+{
+    return { counters[COMPRESSIONS].load(std::memory_order_relaxed),
+             counters[NODES_REHASHED].load(std::memory_order_relaxed),
+             counters[LEAVES_INSERTED].load(std::memory_order_relaxed),
+             counters[LOW_LEAF_SEARCHES].load(std::memory_order_relaxed) };
+}
+
+inline void reset()
+{
+    for (auto& c : counters) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace metrics
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,68 @@
+#include "multiproof.hpp"
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Check that `leaves`, the pre-images of the leaves at `proof.indices`, are in the tree of depth `depth` with root
+ * `root`. The proof must hold exactly the nodes needed, in the order they are needed.
+ */
+template <typename Hasher>
+bool check_hash_paths(fr const& root, size_t depth, hash_multiproof const& proof, std::vector<leaf> const& leaves)
+{
+    if (proof.indices.empty() || leaves.size() != proof.indices.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < proof.indices.size(); i++) {
+        if (proof.indices[i] >> depth != 0 || (i > 0 && proof.indices[i] <= proof.indices[i - 1])) {
+            return false;
+        }
+    }
+
+    std::vector<size_t> indices = proof.indices;
+    std::vector<fr> values(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++) {
+        values[i] = leaves[i].template hash<Hasher>();
+    }
+
+    size_t next_node = 0;
+    for (size_t l = 0; l < depth; l++) {
+        // parents are written back in place, ascending order is preserved as i / 2 is monotonic
+        size_t num_parents = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            const size_t index = indices[i];
+            fr left;
+            fr right;
+            if (!(index & 1) && i + 1 < indices.size() && indices[i + 1] == index + 1) {
+                // both children are known
+                left = values[i];
+                right = values[++i];
+            } else {
+                if (next_node == proof.nodes.size()) {
+                    return false;
+                }
+                const fr& sibling = proof.nodes[next_node++];
+                left = (index & 1) ? sibling : values[i];
+                right = (index & 1) ? values[i] : sibling;
+            }
+            values[num_parents] = compress_pair<Hasher>(left, right);
+            indices[num_parents++] = index / 2;
+        }
+        indices.resize(num_parents);
+        values.resize(num_parents);
+    }
+
+    return next_node == proof.nodes.size() && values[0] == root;
+}
+
+template bool check_hash_paths<pedersen_hasher>(fr const&,
+                                                size_t,
+                                                hash_multiproof const&,
+                                                std::vector<leaf> const&);
+template bool check_hash_paths<blake3s_hasher>(fr const&, size_t, hash_multiproof const&, std::vector<leaf> const&);
+template bool check_hash_paths<sha256_hasher>(fr const&, size_t, hash_multiproof const&, std::vector<leaf> const&);
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
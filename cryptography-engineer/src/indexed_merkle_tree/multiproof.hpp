@@ -0,0 +1,35 @@
+#pragma once
+#include "leaf.hpp"
+#include <vector>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+using namespace barretenberg;
+
+/**
+ * Membership proof of several leaves against a single root.
+ *
+ * Walking up from the proven leaves, the level above is computed from the nodes already known, plus the sibling of
+ * every known node that is not known itself. Only these siblings are part of the proof, level by level from the leaves
+ * up and from left to right within a level: a node shared by the paths of several leaves appears once, and nodes on
+ * the path of another proven leaf are not sent at all.
+ */
+struct hash_multiproof {
+    // indices of the proven leaves, in ascending order and without duplicates
+    std::vector<size_t> indices;
+    std::vector<fr> nodes;
+
+    bool operator==(hash_multiproof const&) const = default;
+};
+
+template <typename Hasher = pedersen_hasher>
+bool check_hash_paths(fr const& root,
+                      size_t depth,
+                      hash_multiproof const& proof,
+                      std::vector<leaf> const& leaves);
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,216 @@
+#include "node_store.hpp"
+#include <algorithm>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Create the storage for an empty tree of the given `depth`, `zero_hashes[l]` being the value of every node at level l.
+ */
+node_store::node_store(size_t depth, std::vector<fr> const& zero_hashes, storage_mode mode)
+    : mode_(mode)
+    , total_size_(leaf_capacity(depth))
+    , zero_hashes_(zero_hashes)
+{
+    ASSERT(depth <= MAX_TREE_DEPTH && zero_hashes_.size() == depth);
+
+    if (mode_ == storage_mode::SPARSE) {
+        sparse_.resize(depth);
+        return;
+    }
+
+    if (mode_ == storage_mode::BLOCKED) {
+        init_blocked(depth);
+    } else {
+        init_dense(depth, false);
+    }
+    dense_storage_.resize(num_nodes_);
+    dense_ = dense_storage_.data();
+    fill_zero_hashes();
+}
+
+/**
+ * Create a dense store over `dense_size(depth)` nodes owned by the caller. The nodes are reset to an empty tree if
+ * `initialise` is set, otherwise they are expected to already hold a tree.
+ */
+node_store::node_store(size_t depth, std::vector<fr> const& zero_hashes, fr* nodes, bool initialise)
+    : mode_(storage_mode::DENSE)
+    , total_size_(leaf_capacity(depth))
+    , zero_hashes_(zero_hashes)
+    , dense_(nodes)
+{
+    ASSERT(depth <= MAX_TREE_DEPTH && zero_hashes_.size() == depth);
+    init_dense(depth, initialise);
+}
+
+node_store::node_store(node_store const& other)
+    : mode_(other.mode_)
+    , total_size_(other.total_size_)
+    , zero_hashes_(other.zero_hashes_)
+    , num_nodes_(other.num_nodes_)
+    , level_str_idxs_(other.level_str_idxs_)
+    , block_levels_(other.block_levels_)
+    , sparse_(other.sparse_)
+    , checkpointed_(other.checkpointed_)
+    , overlay_(other.overlay_)
+{
+    if (other.dense_ != nullptr) {
+        dense_storage_.assign(other.dense_, other.dense_ + num_nodes_);
+        dense_ = dense_storage_.data();
+    }
+}
+
+node_store& node_store::operator=(node_store const& other)
+{
+    if (this != &other) {
+        *this = node_store(other);
+    }
+    return *this;
+}
+
+void node_store::init_dense(size_t depth, bool initialise)
+{
+    // Initialize vector of starting indexes for tree levels
+    level_str_idxs_.push_back(0);
+    for (size_t i = 1; i < depth; i++) {
+        size_t prev = level_str_idxs_[i - 1];
+        level_str_idxs_.push_back(prev + leaf_capacity(depth - (i - 1)));
+    }
+    for (size_t l = 0; l < depth; l++) {
+        block_levels_.push_back({ level_str_idxs_[l], depth - l, 0 });
+    }
+    num_nodes_ = dense_size(depth);
+
+    if (initialise) {
+        fill_zero_hashes();
+    }
+}
+
+void node_store::init_blocked(size_t depth)
+{
+    size_t offset = 0;
+    for (size_t band = 0; band < depth; band += block_levels) {
+        // the blocks of this band hang below the nodes at level `top + 1`, a block of k levels is padded to 2^(k + 1)
+        size_t top = std::min(band + block_levels, depth) - 1;
+        size_t block_shift = top - band + 2;
+        for (size_t l = band; l <= top; l++) {
+            // the padding comes first, so that every pair of siblings is aligned and sits in one cache line
+            size_t depth_in_block = top + 1 - l;
+            block_levels_.push_back({ offset + (1UL << depth_in_block), depth_in_block, block_shift });
+        }
+        offset += (total_size_ >> (top + 1)) << block_shift;
+    }
+    num_nodes_ = offset;
+}
+
+void node_store::fill_zero_hashes()
+{
+    for (size_t l = 0; l < zero_hashes_.size(); l++) {
+        size_t level_size = total_size_ >> l;
+
+#ifndef NO_MULTITHREADING
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < level_size; i++) {
+            dense_[node_position(l, i)] = zero_hashes_[l];
+        }
+    }
+}
+
+/**
+ * Make sure the first `count` nodes of `level` are stored, so that they can be written concurrently.
+ * Nodes that get allocated hold the empty subtree hash of the level, or the value they were written with past the
+ * prefix. Nothing to do for a dense store.
+ */
+void node_store::extend(size_t level, size_t count)
+{
+    if (mode_ != storage_mode::SPARSE) {
+        return;
+    }
+    ASSERT(count <= (total_size_ >> level));
+    auto& nodes = sparse_[level];
+    if (nodes.prefix.size() >= count) {
+        return;
+    }
+    nodes.prefix.resize(count, zero_hashes_[level]);
+    for (auto it = nodes.scattered.begin(); it != nodes.scattered.end();) {
+        if (it->first < count) {
+            nodes.prefix[it->first] = it->second;
+            it = nodes.scattered.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    absorb_scattered(nodes);
+}
+
+void node_store::absorb_scattered(sparse_level& nodes)
+{
+    while (!nodes.scattered.empty()) {
+        auto it = nodes.scattered.find(nodes.prefix.size());
+        if (it == nodes.scattered.end()) {
+            return;
+        }
+        nodes.prefix.push_back(it->second);
+        nodes.scattered.erase(it);
+    }
+}
+
+/**
+ * Returns all the nodes, level after level, in the dense layout, including the ones written since the open checkpoint.
+ * For a sparse store the empty subtrees get expanded, so this is only meant for small trees.
+ */
+std::vector<fr> node_store::get_hashes() const
+{
+    if (mode_ == storage_mode::DENSE) {
+        std::vector<fr> hashes(dense_, dense_ + num_nodes_);
+        for_each_pending([&](size_t position, fr const& value) { hashes[position] = value; });
+        return hashes;
+    }
+
+    std::vector<fr> hashes;
+    hashes.reserve(total_size_ * 2 - 2);
+    for (size_t l = 0; l < zero_hashes_.size(); l++) {
+        for (size_t i = 0; i < (total_size_ >> l); i++) {
+            hashes.push_back(get(l, i));
+        }
+    }
+    return hashes;
+}
+
+/**
+ * Start recording writes in the overlay. Checkpoints do not nest.
+ */
+void node_store::checkpoint()
+{
+    ASSERT(!checkpointed_);
+    checkpointed_ = true;
+}
+
+/**
+ * Write the nodes recorded since the checkpoint to the underlying storage and close the checkpoint.
+ */
+void node_store::commit()
+{
+    ASSERT(checkpointed_);
+    checkpointed_ = false;
+    for (auto const& [key, value] : overlay_) {
+        set_stored(static_cast<size_t>(key >> 32), static_cast<size_t>(key & 0xffffffffULL), value);
+    }
+    overlay_.clear();
+}
+
+/**
+ * Drop the nodes recorded since the checkpoint and close it, the underlying storage was never written to.
+ */
+void node_store::revert()
+{
+    ASSERT(checkpointed_);
+    checkpointed_ = false;
+    overlay_.clear();
+}
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,235 @@
+#pragma once
+#include <common/assert.hpp>
+#include <ecc/curves/bn254/fr.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+using namespace barretenberg;
+
+enum class storage_mode {
+    DENSE,   // every node of the tree is allocated up front
+    SPARSE,  // only the nodes above occupied leaves are allocated
+    BLOCKED, // like DENSE, with subtrees of `block_levels` levels stored contiguously
+};
+
+/**
+ * Deepest supported tree. A tree of depth d has 2^d leaves, which are counted and indexed by `size_t`: a depth of 32 is
+ * only supported on 64-bit targets.
+ */
+constexpr size_t MAX_TREE_DEPTH = sizeof(size_t) > sizeof(uint32_t) ? 32 : 31;
+
+// Number of leaves of a tree of depth `depth`, at most `MAX_TREE_DEPTH` (`1UL << 32` overflows a 32-bit unsigned long)
+constexpr size_t leaf_capacity(size_t depth)
+{
+    return static_cast<size_t>(uint64_t{ 1 } << depth);
+}
+
+/**
+ * Storage of a tree created without a storage mode: DENSE, unless its nodes alone would take more than the memory
+ * budget of the build (MEMORY_BUDGET_MB, which defaults to 1024 on WASM). The nodes of a dense tree of depth d take
+ * 2^(d + 6) bytes, so a depth of 24 is already more than a 32-bit WASM memory can hold next to the leaves.
+ */
+inline storage_mode default_storage_mode(size_t depth)
+{
+#ifdef MEMORY_BUDGET_MB
+    if ((uint64_t(2) << depth) * sizeof(fr) > (uint64_t(MEMORY_BUDGET_MB) << 20)) {
+        return storage_mode::SPARSE;
+    }
+#else
+    static_cast<void>(depth);
+#endif
+    return storage_mode::DENSE;
+}
+
+/**
+ * Storage for the nodes of an indexed merkle tree. Nodes are addressed by their level and their index within the
+ * level: level 0 holds the leaf hashes and level (depth - 1) holds the two children of the root.
+ *
+ * DENSE stores all the levels one after another in a single array, exactly as sketched in `IndexedMerkleTree`. The
+ * array is either owned by the store or, for a persisted tree, lives in a memory mapped file (copies own their array).
+ *
+ * SPARSE keeps one vector per level that only holds the leftmost nodes of that level. Leaves of an indexed merkle tree
+ * are appended from left to right, so the nodes above the occupied leaves always form a prefix of their level. Every
+ * node past that prefix is the root of an empty subtree and is read from the `zero_hashes` table instead. A node
+ * written past the end of the prefix (a commit writes its nodes in no particular order) is kept in a map until the
+ * prefix reaches it, so that a far index never allocates the nodes before it.
+ *
+ * BLOCKED allocates every node like DENSE, but cuts the tree into bands of `block_levels` levels starting from the
+ * leaves. The nodes of a band that share an ancestor just above the band, i.e. the two subtrees of that ancestor (30
+ * nodes for 4 levels, padded to 32), are stored contiguously:
+ *
+ *   | band 0: block 0 | block 1 | ... | band 1: block 0 | ... |      block: | pad | 2 roots | 4 | 8 | 16 leaves |
+ *
+ * A hash path then reads a single 1KB block, rather than a separate page of the array per level, in every band. The
+ * padding costs about 7% over DENSE.
+ *
+ * While a checkpoint is open, writes go to an overlay that only holds the touched nodes and reads fall through to the
+ * underlying storage for all the other nodes. Committing writes the overlay back, reverting drops it.
+ */
+class node_store {
+  public:
+    node_store(size_t depth, std::vector<fr> const& zero_hashes, storage_mode mode);
+    node_store(size_t depth, std::vector<fr> const& zero_hashes, fr* nodes, bool initialise);
+
+    node_store(node_store const& other);
+    node_store(node_store&& other) noexcept = default;
+    node_store& operator=(node_store const& other);
+    node_store& operator=(node_store&& other) noexcept = default;
+
+    // Number of nodes in a dense store
+    static constexpr size_t dense_size(size_t depth) { return leaf_capacity(depth) * 2 - 2; }
+
+    static constexpr size_t block_levels = 4;
+
+    fr get(size_t level, size_t index) const
+    {
+        if (checkpointed_) {
+            auto it = overlay_.find(overlay_key(level, index));
+            if (it != overlay_.end()) {
+                return it->second;
+            }
+        }
+        return get_stored(level, index);
+    }
+
+    // Value of a node in the underlying storage, ignoring the updates recorded since the open checkpoint
+    fr get_stored(size_t level, size_t index) const
+    {
+        if (mode_ != storage_mode::SPARSE) {
+            return dense_[node_position(level, index)];
+        }
+        auto const& nodes = sparse_[level];
+        if (index < nodes.prefix.size()) {
+            return nodes.prefix[index];
+        }
+        if (!nodes.scattered.empty()) {
+            auto it = nodes.scattered.find(index);
+            if (it != nodes.scattered.end()) {
+                return it->second;
+            }
+        }
+        return zero_hashes_[level];
+    }
+
+    void set(size_t level, size_t index, fr const& value)
+    {
+        if (checkpointed_) {
+            overlay_[overlay_key(level, index)] = value;
+            return;
+        }
+        set_stored(level, index, value);
+    }
+
+    void extend(size_t level, size_t count);
+
+    // Number of nodes at `level` that are actually stored
+    size_t stored_size(size_t level) const
+    {
+        return mode_ != storage_mode::SPARSE ? (total_size_ >> level) : sparse_[level].prefix.size();
+    }
+
+    fr const& zero_hash(size_t level) const { return zero_hashes_[level]; }
+
+    // The array of a DENSE store, level after level, while no checkpoint is open, nullptr otherwise
+    fr const* dense_nodes() const { return mode_ == storage_mode::DENSE && !checkpointed_ ? dense_ : nullptr; }
+
+    std::vector<fr> get_hashes() const;
+
+    void checkpoint();
+    void commit();
+    void revert();
+    bool checkpointed() const { return checkpointed_; }
+
+    // Calls `f(position, value)` for every node written since the open checkpoint of a DENSE store, `position` being
+    // that of the node in the array
+    template <typename F> void for_each_pending(F&& f) const
+    {
+        ASSERT(mode_ == storage_mode::DENSE);
+        for (auto const& [key, value] : overlay_) {
+            f(node_position(static_cast<size_t>(key >> 32), static_cast<size_t>(key & 0xffffffffULL)), value);
+        }
+    }
+
+    storage_mode mode() const { return mode_; }
+
+  private:
+    void init_dense(size_t depth, bool initialise);
+    void init_blocked(size_t depth);
+    void fill_zero_hashes();
+
+    // an index within a level is below 2^32 as the depth is at most 32
+    static uint64_t overlay_key(size_t level, size_t index) { return (static_cast<uint64_t>(level) << 32) | index; }
+
+    // Position of a node in the array of a DENSE or BLOCKED store, a DENSE level being laid out as a single block
+    size_t node_position(size_t level, size_t index) const
+    {
+        auto const& block = block_levels_[level];
+        const size_t index_in_block = index & (leaf_capacity(block.depth) - 1);
+        return block.offset + ((index >> block.depth) << block.block_shift) + index_in_block;
+    }
+
+    void set_stored(size_t level, size_t index, fr const& value)
+    {
+        if (mode_ != storage_mode::SPARSE) {
+            dense_[node_position(level, index)] = value;
+            return;
+        }
+        auto& nodes = sparse_[level];
+        if (index < nodes.prefix.size()) {
+            nodes.prefix[index] = value;
+        } else if (index == nodes.prefix.size()) {
+            nodes.prefix.push_back(value);
+            absorb_scattered(nodes);
+        } else {
+            ASSERT(index < (total_size_ >> level));
+            nodes.scattered[index] = value;
+        }
+    }
+
+    storage_mode mode_;
+
+    // The total number of leaves in the tree
+    size_t total_size_;
+
+    // Value of every node at a given level of an empty tree
+    std::vector<fr> zero_hashes_;
+
+    // DENSE and BLOCKED: all the nodes, their number and the vector owning them unless they are mapped from a file
+    fr* dense_ = nullptr;
+    size_t num_nodes_ = 0;
+    std::vector<fr> dense_storage_;
+
+    // DENSE: the starting index of each level
+    std::vector<size_t> level_str_idxs_;
+
+    // For each level, the position of its first node within a block of its band (the band offset included), its depth
+    // within the blocks and log2 of the block size
+    struct block_level {
+        size_t offset;
+        size_t depth;
+        size_t block_shift;
+    };
+    std::vector<block_level> block_levels_;
+
+    // SPARSE: the stored prefix of every level, and the nodes written past it
+    struct sparse_level {
+        std::vector<fr> prefix;
+        std::unordered_map<size_t, fr> scattered;
+    };
+    std::vector<sparse_level> sparse_;
+
+    // moves the nodes right after the prefix of `nodes` from its map into the prefix
+    static void absorb_scattered(sparse_level& nodes);
+
+    // Nodes written since the open checkpoint, if any
+    bool checkpointed_ = false;
+    std::unordered_map<uint64_t, fr> overlay_;
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
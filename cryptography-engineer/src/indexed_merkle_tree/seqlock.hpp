@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#ifndef NO_MULTITHREADING
+#include <mutex>
+#include <shared_mutex>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Sequence lock for a single writer and any number of readers. Readers never block the writer and never write to
+ * shared memory, they retry whenever their read overlapped a write:
+ *
+ *     uint64_t seq;
+ *     do {
+ *         seq = lock.read_begin();
+ *         ... copy the protected data ...
+ *     } while (lock.read_retry(seq));
+ *
+ * The writer wraps its updates of the protected data in `write_begin` / `write_end`, and should keep them short.
+ */
+class seqlock {
+  public:
+    seqlock() = default;
+    seqlock(seqlock const& other)
+        : sequence_(other.sequence_.load(std::memory_order_relaxed))
+    {}
+    seqlock& operator=(seqlock const& other)
+    {
+        sequence_.store(other.sequence_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void write_begin()
+    {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void write_end() { sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    uint64_t read_begin() const
+    {
+        // an odd sequence number means a write is in progress
+        uint64_t seq = sequence_.load(std::memory_order_acquire);
+        while (seq & 1) {
+            seq = sequence_.load(std::memory_order_acquire);
+        }
+        return seq;
+    }
+
+    bool read_retry(uint64_t seq) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence_.load(std::memory_order_relaxed) != seq;
+    }
+
+  private:
+    // on its own cache line, so that the readers polling it do not share it with anything the writer updates
+    alignas(64) std::atomic<uint64_t> sequence_ = 0;
+};
+
+/**
+ * Reader-writer lock for the shared data that readers cannot copy optimistically under a `seqlock`: a node based
+ * container such as a map may free the nodes a reader is walking through, a growing vector may be reallocated under
+ * it. Copies get a lock of their own, and without multithreading there is nothing to lock.
+ */
+class rw_lock {
+  public:
+    rw_lock() = default;
+    rw_lock(rw_lock const&) {}
+    rw_lock& operator=(rw_lock const&) { return *this; }
+
+    template <typename F> auto read(F&& f) const
+    {
+#ifndef NO_MULTITHREADING
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+#endif
+        return f();
+    }
+
+    template <typename F> void write(F&& f)
+    {
+#ifndef NO_MULTITHREADING
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+#endif
+        f();
+    }
+
+  private:
+#ifndef NO_MULTITHREADING
+    mutable std::shared_mutex mutex_;
+#endif
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
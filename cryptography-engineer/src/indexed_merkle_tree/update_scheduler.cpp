@@ -0,0 +1,130 @@
+#include "update_scheduler.hpp"
+#include <utility>
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+template <typename Hasher>
+update_scheduler<Hasher>::update_scheduler(IndexedMerkleTree<Hasher>& tree,
+                                           async::task_pool& pool,
+                                           std::shared_ptr<async::task_control> control)
+    : tree_(tree)
+    , pool_(pool)
+    , control_(std::move(control))
+{}
+
+template <typename Hasher> update_scheduler<Hasher>::~update_scheduler()
+{
+    wait();
+}
+
+/**
+ * Without multithreading, the updates have all run by the time they are scheduled.
+ */
+template <typename Hasher> void update_scheduler<Hasher>::wait()
+{
+#ifndef NO_MULTITHREADING
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return !running_; });
+#endif
+}
+
+/**
+ * The update is queued, and only submitted to the pool right away if no other update of the tree is in flight.
+ * Otherwise the task of the update in flight submits it once it has finished. An update that throws hands its error to
+ * its own future and does not hold up the updates scheduled after it.
+ */
+template <typename Hasher>
+template <typename F, typename S>
+std::future<std::invoke_result_t<F, IndexedMerkleTree<Hasher>&>> update_scheduler<Hasher>::schedule(F update,
+                                                                                                    S skipped,
+                                                                                                    size_t steps)
+{
+    using result_t = std::invoke_result_t<F, IndexedMerkleTree<Hasher>&>;
+    auto task = std::make_shared<std::packaged_task<result_t()>>(
+        [this, update = std::move(update), skipped = std::move(skipped), steps]() -> result_t {
+            if (control_ && control_->is_cancelled()) {
+                return skipped(tree_);
+            }
+            auto result = update(tree_);
+            if (control_) {
+                control_->advance(steps);
+            }
+            return result;
+        });
+    auto result = task->get_future();
+    if (control_) {
+        control_->add_total(steps);
+    }
+
+    {
+#ifndef NO_MULTITHREADING
+        std::lock_guard<std::mutex> lock(mutex_);
+#endif
+        pending_.push_back([task]() { (*task)(); });
+        if (running_) {
+            return result;
+        }
+        running_ = true;
+    }
+    submit_next();
+    return result;
+}
+
+template <typename Hasher> void update_scheduler<Hasher>::submit_next()
+{
+    std::function<void()> next;
+    {
+#ifndef NO_MULTITHREADING
+        std::lock_guard<std::mutex> lock(mutex_);
+#endif
+        next = std::move(pending_.front());
+        pending_.pop_front();
+    }
+    pool_.submit([this, next = std::move(next)]() {
+        next();
+        {
+#ifndef NO_MULTITHREADING
+            std::lock_guard<std::mutex> lock(mutex_);
+#endif
+            if (pending_.empty()) {
+                // the scheduler may be gone as soon as the lock is released
+                running_ = false;
+#ifndef NO_MULTITHREADING
+                idle_.notify_all();
+#endif
+                return;
+            }
+        }
+        submit_next();
+    });
+}
+
+template <typename Hasher>
+std::future<batch_update_result> update_scheduler<Hasher>::update_elements(std::vector<fr> values)
+{
+    const size_t steps = values.size();
+    return schedule(
+        [values = std::move(values)](IndexedMerkleTree<Hasher>& tree) { return tree.update_elements(values); },
+        [](IndexedMerkleTree<Hasher>& tree) { return batch_update_result{ tree.root(), {} }; },
+        steps);
+}
+
+template <typename Hasher>
+std::future<fr> update_scheduler<Hasher>::apply_leaf_updates(std::vector<leaf_update> updates)
+{
+    const size_t steps = updates.size();
+    return schedule(
+        [updates = std::move(updates)](IndexedMerkleTree<Hasher>& tree) { return tree.apply_leaf_updates(updates); },
+        [](IndexedMerkleTree<Hasher>& tree) { return tree.root(); },
+        steps);
+}
+
+template class update_scheduler<pedersen_hasher>;
+template class update_scheduler<blake3s_hasher>;
+template class update_scheduler<sha256_hasher>;
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk
@@ -0,0 +1,71 @@
+#pragma once
+#include "indexed_merkle_tree.hpp"
+#include <async/task_control.hpp>
+#include <async/task_pool.hpp>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#ifndef NO_MULTITHREADING
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace plonk {
+namespace stdlib {
+namespace indexed_merkle_tree {
+
+/**
+ * Runs the updates of a tree as tasks of a pool, one after the other in the order they were scheduled. The updates of
+ * several trees, and SRS conversions, scheduled on the same pool run side by side, while each update still hashes its
+ * leaves and levels with all the cores. An update is only submitted to the pool once the one before it has finished,
+ * so no task of the pool ever waits for another one.
+ *
+ * A `control` follows all the updates of the scheduler: its progress counts the values and leaf updates applied, out of
+ * all those scheduled. Once it is cancelled, every update that has not started yet is skipped and leaves the tree as it
+ * is. The future of a skipped update holds the current root of the tree, and no low leaves.
+ *
+ * While updates are scheduled, the tree may only be read through `get_committed_hash_path` (and the other published
+ * reads), which always see the root of a finished update. Anything else must wait for `wait()`.
+ */
+template <typename Hasher = pedersen_hasher> class update_scheduler {
+  public:
+    explicit update_scheduler(IndexedMerkleTree<Hasher>& tree,
+                              async::task_pool& pool = async::task_pool::shared(),
+                              std::shared_ptr<async::task_control> control = nullptr);
+
+    // waits for the updates scheduled, the tree must outlive them
+    ~update_scheduler();
+
+    update_scheduler(update_scheduler const&) = delete;
+    update_scheduler& operator=(update_scheduler const&) = delete;
+
+    std::future<batch_update_result> update_elements(std::vector<fr> values);
+
+    std::future<fr> apply_leaf_updates(std::vector<leaf_update> updates);
+
+    // waits for all the updates scheduled so far
+    void wait();
+
+  private:
+    template <typename F, typename S>
+    std::future<std::invoke_result_t<F, IndexedMerkleTree<Hasher>&>> schedule(F update, S skipped, size_t steps);
+    void submit_next();
+
+    IndexedMerkleTree<Hasher>& tree_;
+    async::task_pool& pool_;
+    std::shared_ptr<async::task_control> control_;
+
+    // updates scheduled and not submitted yet, and whether one has been submitted and has not finished
+    std::deque<std::function<void()>> pending_;
+    bool running_ = false;
+#ifndef NO_MULTITHREADING
+    std::mutex mutex_;
+    std::condition_variable idle_;
+#endif
+};
+
+} // namespace indexed_merkle_tree
+} // namespace stdlib
+} // namespace plonk